@@ -0,0 +1,113 @@
+/*
+ * Nostalgia - A custom Minecraft server.
+ * Copyright (C) 2019  Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//
+// Compares palette_builder against the std::map based palette generation
+// that chunk sections used to do (one lookup to build the palette and
+// another to remap every block to its palette index).
+//
+
+#include "world/palette.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <vector>
+
+
+static constexpr int section_blocks = 4096;
+static constexpr int iterations = 20000;
+
+static unsigned int
+_map_palette (const unsigned short *ids, std::vector<unsigned short>& palette,
+              unsigned short *indices)
+{
+  std::map<unsigned short, unsigned short> index_map;
+
+  palette.clear ();
+  for (int i = 0; i < section_blocks; ++i)
+    {
+      auto id = ids[i];
+      if (index_map.find (id) == index_map.end ())
+        {
+          index_map[id] = (unsigned short)palette.size ();
+          palette.push_back (id);
+        }
+    }
+
+  for (int i = 0; i < section_blocks; ++i)
+    indices[i] = index_map[ids[i]];
+
+  return (unsigned int)palette.size ();
+}
+
+//! \brief Fills a section with blocks picked at random out of num_distinct ids.
+static std::vector<unsigned short>
+_make_section (unsigned int num_distinct, std::mt19937& rng)
+{
+  std::vector<unsigned short> ids (section_blocks);
+  for (auto& id : ids)
+    id = (unsigned short)((rng () % num_distinct) * 7 + 1);
+  return ids;
+}
+
+template<typename Fn>
+static double
+_time_ns (Fn&& fn)
+{
+  auto start = std::chrono::steady_clock::now ();
+  for (int i = 0; i < iterations; ++i)
+    fn ();
+  auto elapsed = std::chrono::steady_clock::now () - start;
+  return std::chrono::duration<double, std::nano> (elapsed).count () / iterations;
+}
+
+
+int
+main ()
+{
+  std::mt19937 rng (1234);
+  palette_builder builder;
+
+  std::printf ("%-10s %14s %14s %8s\n", "distinct", "std::map (ns)", "builder (ns)", "speedup");
+  for (unsigned int num_distinct : { 1, 3, 16, 64, 256, 1024 })
+    {
+      auto ids = _make_section (num_distinct, rng);
+      std::vector<unsigned short> map_palette, lut_palette;
+      unsigned short map_indices[section_blocks], lut_indices[section_blocks];
+
+      // both must produce the same result
+      _map_palette (ids.data (), map_palette, map_indices);
+      builder.build (ids.data (), section_blocks, lut_palette, lut_indices);
+      if (map_palette != lut_palette || !std::equal (map_indices, map_indices + section_blocks, lut_indices))
+        {
+          std::printf ("MISMATCH for %u distinct blocks\n", num_distinct);
+          return EXIT_FAILURE;
+        }
+
+      volatile unsigned int sink = 0;
+      auto map_ns = _time_ns ([&] { sink += _map_palette (ids.data (), map_palette, map_indices); });
+      auto lut_ns = _time_ns ([&] { sink += builder.build (ids.data (), section_blocks, lut_palette, lut_indices); });
+
+      std::printf ("%-10u %14.0f %14.0f %7.1fx\n", num_distinct, map_ns, lut_ns, map_ns / lut_ns);
+    }
+
+  return EXIT_SUCCESS;
+}
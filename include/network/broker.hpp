@@ -0,0 +1,156 @@
+/*
+ * Nostalgia - A custom Minecraft server.
+ * Copyright (C) 2019  Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef NOSTALGIA_BROKER_HPP
+#define NOSTALGIA_BROKER_HPP
+
+#include "network/packet_buffer.hpp"
+#include <caf/all.hpp>
+#include <caf/io/all.hpp>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <chrono>
+
+
+/*!
+ * \class inbound_buffer
+ * \brief Accumulates bytes read from a connection and splits them into
+ *        length-prefixed packet frames.
+ *
+ * Bytes are appended at the tail and consumed from the head. Consumed space
+ * is reclaimed by sliding the unconsumed remainder back to the front of the
+ * buffer, so the underlying storage is reused across reads.
+ */
+class inbound_buffer
+{
+  std::vector<char> buf;
+  size_t head = 0; // offset of the first unconsumed byte
+  size_t tail = 0; // offset one past the last received byte
+
+ public:
+  [[nodiscard]] inline size_t size () const { return this->tail - this->head; }
+
+  //! \brief Appends received bytes to the end of the buffer.
+  void append (const char *data, size_t len);
+
+  /*!
+   * \brief Extracts the next complete frame from the buffer.
+   * \param frame Receives the contents of the frame (without the length prefix).
+   * \return True if a whole frame was extracted, false if more data is needed.
+   * \throws bad_data_error If the length prefix is malformed or too large.
+   */
+  bool next_frame (std::vector<char>& frame);
+};
+
+
+/*!
+ * \brief Tunables shared by all client brokers (set from the command line or
+ *        config file, see nostalgia_config).
+ */
+struct broker_settings
+{
+  //! Outbound packets are flushed at most this long after being queued.
+  caf::timespan flush_interval;
+
+  //! Queued bytes that trigger an immediate flush.
+  size_t flush_threshold;
+
+  //! Packets this large or larger get compressed (negative disables compression).
+  int compression_threshold;
+
+  //! Pool of actors that compress outbound frames.
+  caf::actor compressor;
+
+  //! Unsent bytes after which chunk and block updates are held back.
+  size_t outbound_byte_budget;
+
+  //! Max number of packets held back for a single client.
+  size_t outbound_packet_budget;
+
+  //! Clients that stay over their byte budget for this long are disconnected.
+  caf::timespan overload_timeout;
+};
+
+//! \brief An outbound frame waiting for earlier frames to finish compressing.
+struct pending_frame
+{
+  std::vector<char> data;
+  bool ready = false;
+};
+
+//! \brief A world update held back while the client is over its byte budget.
+struct deferred_packet
+{
+  packet_buffer buf;
+  bool keyed = false; // true for BLOCK CHANGE packets
+  uint64_t key = 0; // encoded position of a BLOCK CHANGE packet
+  bool dropped = false; // superseded by a later packet
+};
+
+struct client_broker_state
+{
+  caf::actor srv;
+  caf::actor cl;
+  unsigned int client_id;
+  broker_settings settings;
+
+  inbound_buffer inbound;
+
+  // outbound batching:
+  size_t queued_bytes = 0; // bytes written since the last flush
+  unsigned int queued_packets = 0; // packets written since the last flush
+  bool flush_scheduled = false;
+  uint64_t total_packets = 0;
+  uint64_t total_flushes = 0;
+  bool closing = false; // set when the server (not the peer) closes the connection
+
+  // compression:
+  int compression_threshold = -1; // negative until compression is enabled
+  std::deque<pending_frame> pending;
+  uint64_t pending_base = 0; // sequence number of the first pending frame
+
+  // backpressure:
+  size_t in_flight = 0; // bytes flushed but not written to the socket yet
+  std::deque<deferred_packet> deferred;
+  uint64_t deferred_base = 0; // sequence number of the first deferred packet
+  size_t deferred_live = 0; // deferred packets that were not dropped
+  std::unordered_map<uint64_t, uint64_t> deferred_block_changes; // position -> sequence number
+  bool overloaded = false;
+  std::chrono::steady_clock::time_point overloaded_since;
+  bool disconnecting = false;
+};
+
+struct server_broker_state
+{
+  std::vector<std::unique_ptr<client_broker_state>> states;
+  unsigned int next_client_id = 1;
+  broker_settings settings;
+};
+
+
+caf::behavior
+client_broker_impl (caf::io::broker *self, caf::io::connection_handle hdl,
+                    client_broker_state *state);
+
+caf::behavior
+server_broker_impl (caf::io::broker *self, server_broker_state *state,
+                    const caf::actor& srv, const caf::actor& script_eng);
+
+#endif //NOSTALGIA_BROKER_HPP
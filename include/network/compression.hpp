@@ -0,0 +1,56 @@
+/*
+ * Nostalgia - A custom Minecraft server.
+ * Copyright (C) 2019  Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef NOSTALGIA_COMPRESSION_HPP
+#define NOSTALGIA_COMPRESSION_HPP
+
+#include <caf/all.hpp>
+#include <vector>
+
+
+/*!
+ * \brief Converts a frame produced by packet_writer into the format used once
+ *        compression is enabled, without compressing it (data length of 0).
+ */
+void make_uncompressed_frame (std::vector<char>& frame);
+
+/*!
+ * \brief Compresses the payload of a frame produced by packet_writer and
+ *        returns a complete compressed frame (length prefix included).
+ */
+std::vector<char> make_compressed_frame (const std::vector<char>& frame);
+
+/*!
+ * \brief Unpacks the body of a frame received while compression is enabled.
+ * \param frame Frame contents (without the length prefix).
+ * \param out Receives the uncompressed packet.
+ * \throws bad_data_error If the frame is ill-formed or does not inflate properly.
+ */
+void read_compressed_frame (const std::vector<char>& frame, std::vector<char>& out);
+
+
+/*!
+ * \brief Behavior of the actors that compress outbound frames on behalf of
+ *        client brokers, so that the work is kept off the I/O thread and
+ *        off the actors producing the packets.
+ *
+ * Usually spawned as a pool of workers.
+ */
+caf::behavior compressor_impl (caf::event_based_actor *self);
+
+#endif //NOSTALGIA_COMPRESSION_HPP
@@ -0,0 +1,77 @@
+/*
+ * Nostalgia - A custom Minecraft server.
+ * Copyright (C) 2019  Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef NOSTALGIA_PACKET_BUFFER_HPP
+#define NOSTALGIA_PACKET_BUFFER_HPP
+
+#include <caf/all.hpp>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+
+// forward decs:
+class packet_writer;
+
+/*!
+ * \class packet_buffer
+ * \brief An immutable, reference-counted packet frame.
+ *
+ * Used for packets that are sent to many clients at once (broadcasts): the
+ * frame is allocated once and every broker reads from the same buffer.
+ * The frame has the same layout as the buffer produced by packet_writer,
+ * i.e. its length prefix has not been filled in.
+ */
+class packet_buffer
+{
+  struct shared_frame
+  {
+    std::vector<char> frame;
+
+    // compressed form of the frame, created on first use
+    std::once_flag compress_flag;
+    std::vector<char> compressed;
+  };
+
+  std::shared_ptr<shared_frame> ptr;
+
+ public:
+  packet_buffer () = default;
+  explicit packet_buffer (std::vector<char>&& frame);
+  explicit packet_buffer (packet_writer&& writer);
+
+  [[nodiscard]] inline const std::vector<char>& frame () const { return this->ptr->frame; }
+
+  //! \brief Returns the size of the packet (excluding the frame header).
+  [[nodiscard]] size_t payload_size () const;
+
+  //! \brief Returns a pointer to the packet (past the frame header).
+  [[nodiscard]] const char* payload () const;
+
+  /*!
+   * \brief Returns a complete compressed frame for this packet.
+   *
+   * The frame is compressed once, by whichever thread asks for it first,
+   * and shared from then on.
+   */
+  const std::vector<char>& compressed_frame () const;
+};
+
+CAF_ALLOW_UNSAFE_MESSAGE_TYPE(packet_buffer)
+
+#endif //NOSTALGIA_PACKET_BUFFER_HPP
@@ -20,6 +20,8 @@
 #define NOSTALGIA_PACKET_READER_HPP
 
 #include <vector>
+#include <string>
+#include <string_view>
 #include <cstdint>
 #include <exception>
 #include "util/position.hpp"
@@ -65,6 +67,14 @@ class packet_reader
   float read_float ();
   double read_double ();
   std::string read_string (unsigned max_size = 0);
+
+  /*!
+   * \brief Reads a string without copying it.
+   *
+   * The returned view points into the underlying buffer and is only valid
+   * for as long as the buffer is.
+   */
+  std::string_view read_string_view (unsigned max_size = 0);
   block_pos read_position ();
   void read_bytes (void *out, unsigned int len);
 
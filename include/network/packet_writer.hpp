@@ -23,21 +23,50 @@
 #include "util/position.hpp"
 #include <vector>
 #include <cstdint>
+#include <cstddef>
+#include <exception>
 
 
 // forward decs:
 class nbt_writer;
 
+//! \brief Number of bytes reserved in front of every packet for its length prefix.
+constexpr unsigned int packet_header_size = 3;
+
+/*!
+ * \class packet_writer
+ * \brief Serializes a single packet.
+ *
+ * The buffer starts with packet_header_size bytes of headroom, so that once
+ * the packet is complete its length prefix can be patched in place (see
+ * write_frame_header) and the whole frame sent as one contiguous buffer.
+ */
 class packet_writer
 {
-  std::vector<char> buf;
-  unsigned int pos = 0;
+  std::vector<char> buf; // may be larger than what was written so far
+  unsigned int pos = packet_header_size;
 
  public:
-  inline unsigned int position () const { return this->pos; }
+  packet_writer ();
+
+  //! \brief Makes sure at least len more bytes can be written without reallocating.
+  inline void reserve (unsigned int len) { this->ensure (len); }
+
+  //! \brief Returns the number of payload bytes written so far.
+  inline unsigned int position () const { return this->pos - packet_header_size; }
+
+  //! \brief Returns a pointer to the packet payload (past the reserved headroom).
+  inline const char* data () const { return this->buf.data () + packet_header_size; }
 
-  inline const char* data () const { return this->buf.data (); }
-  inline std::vector<char>&& move_data () { return std::move (buf); }
+  /*!
+   * \brief Moves out the packet frame: packet_header_size reserved bytes
+   *        followed by the payload.
+   */
+  inline std::vector<char>&& move_data ()
+  {
+    this->buf.resize (this->pos);
+    return std::move (this->buf);
+  }
 
   void write_bool (bool val);
   void write_byte (uint8_t val);
@@ -52,9 +81,59 @@ class packet_writer
   void write_uuid_string (const uuid_t& uuid);
   void write_position (block_pos pos);
   void write_nbt (const nbt_writer& writer);
+
+ private:
+  //! \brief Returns a pointer to the write position, having made room for len bytes.
+  inline char* ensure (unsigned int len)
+  {
+    if (this->pos + len > this->buf.size ())
+      this->expand (len);
+    return this->buf.data () + this->pos;
+  }
+
+  void expand (unsigned int len);
 };
 
 //! \brief Returns the size in bytes of a specified varlong.
 unsigned int varlong_size (uint64_t val);
 
+/*!
+ * \brief Encodes a varlong into the specified buffer.
+ * \param out Must have room for at least 10 bytes.
+ * \return The number of bytes written.
+ */
+unsigned int encode_varlong (uint64_t val, char *out);
+
+/*!
+ * \class packet_too_large_error
+ * \brief Thrown when a packet is too large for its length to fit in the
+ *        frame header (see max_packet_size).
+ */
+class packet_too_large_error : public std::exception
+{
+  size_t sz;
+
+ public:
+  explicit packet_too_large_error (size_t sz)
+    : sz (sz)
+  {}
+
+  inline size_t size () const { return this->sz; }
+};
+
+/*!
+ * \brief Writes a frame length prefix padded to exactly packet_header_size bytes.
+ * \throws packet_too_large_error If the length is larger than max_packet_size.
+ */
+void write_padded_length (char *out, unsigned int len);
+
+/*!
+ * \brief Fills in the length prefix of a frame produced by packet_writer.
+ *
+ * The length is encoded as a varint padded to exactly packet_header_size
+ * bytes, which is valid for the protocol and keeps the payload in place.
+ * \throws packet_too_large_error If the packet is larger than max_packet_size.
+ */
+void write_frame_header (std::vector<char>& frame);
+
 #endif //NOSTALGIA_PACKET_WRITER_HPP
@@ -22,12 +22,23 @@
 #include "util/uuid.hpp"
 #include "network/packet_writer.hpp"
 #include <string>
+#include <vector>
 
 
+//! \brief A single entry in a MULTI BLOCK CHANGE packet.
+struct block_change_record
+{
+  unsigned char xz; // x << 4 | z, relative to the chunk
+  unsigned char y;
+  unsigned short id;
+};
+
 namespace packets::play {
 
   packet_writer make_block_change (block_pos pos, unsigned short block_id);
 
+  packet_writer make_multi_block_change (int cx, int cz, const std::vector<block_change_record>& records);
+
   packet_writer make_chat_message_simple (const std::string& msg, char position);
 
   packet_writer make_disconnect (const std::string& msg);
@@ -57,6 +68,8 @@ namespace packets::login {
   packet_writer make_disconnect (const std::string& msg);
 
   packet_writer make_login_success (const uuid_t& uuid, const std::string& username);
+
+  packet_writer make_set_compression (int threshold);
 }
 
 #endif //NOSTALGIA_PACKETS_HPP
@@ -52,6 +52,12 @@ int world_get_block (lua_State *L);
 //! \brief world:save()
 int world_save (lua_State *L);
 
+//! \brief world:pin_chunk(cx, cz)
+int world_pin_chunk (lua_State *L);
+
+//! \brief world:unpin_chunk(cx, cz)
+int world_unpin_chunk (lua_State *L);
+
 }
 
 #endif //NOSTALGIA_SCRIPTING_WORLD_HPP
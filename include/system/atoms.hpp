@@ -34,6 +34,10 @@ using packet_in_atom = caf::atom_constant<caf::atom ("1_2")>;
 using packet_out_atom = caf::atom_constant<caf::atom ("1_3")>;
 using message_atom = caf::atom_constant<caf::atom ("1_4")>;
 using event_complete_atom = caf::atom_constant<caf::atom ("1_5")>;
+using flush_atom = caf::atom_constant<caf::atom ("1_6")>;
+using enable_compression_atom = caf::atom_constant<caf::atom ("1_7")>;
+using compress_atom = caf::atom_constant<caf::atom ("1_8")>;
+using check_overload_atom = caf::atom_constant<caf::atom ("1_9")>;
 
 // scripting engine atoms:
 using run_command_atom = caf::atom_constant<caf::atom ("2_1")>;
@@ -50,7 +54,6 @@ using del_client_atom = caf::atom_constant<caf::atom ("3_2")>;
 using get_client_atom = caf::atom_constant<caf::atom ("3_3")>;
 using set_client_atom = caf::atom_constant<caf::atom ("3_4")>;
 using get_world_atom = caf::atom_constant<caf::atom ("3_5")>;
-using broadcast_packet_atom = caf::atom_constant<caf::atom ("3_6")>;
 using global_message_atom = caf::atom_constant<caf::atom ("3_7")>;
 
 // world generator atoms:
@@ -59,6 +62,21 @@ using generate_atom = caf::atom_constant<caf::atom ("4_1")>;
 // world atoms:
 using request_chunk_data_atom = caf::atom_constant<caf::atom ("5_1")>;
 using set_block_atom = caf::atom_constant<caf::atom ("5_2")>;
+using unload_chunk_atom = caf::atom_constant<caf::atom ("5_3")>;
+using world_tick_atom = caf::atom_constant<caf::atom ("5_4")>;
+using join_world_atom = caf::atom_constant<caf::atom ("5_5")>;
+using chunk_encoded_atom = caf::atom_constant<caf::atom ("5_6")>;
+using leave_world_atom = caf::atom_constant<caf::atom ("5_7")>;
+using lighting_update_atom = caf::atom_constant<caf::atom ("5_8")>;
+using border_chunk_atom = caf::atom_constant<caf::atom ("5_9")>;
+using request_border_chunks_atom = caf::atom_constant<caf::atom ("5_10")>;
+using share_border_chunk_atom = caf::atom_constant<caf::atom ("5_11")>;
+using pin_chunk_atom = caf::atom_constant<caf::atom ("5_12")>;
+using unpin_chunk_atom = caf::atom_constant<caf::atom ("5_13")>;
+using drop_border_chunk_atom = caf::atom_constant<caf::atom ("5_14")>;
+
+// chunk encoder atoms:
+using encode_chunk_atom = caf::atom_constant<caf::atom ("6_1")>;
 
 // scripting request/response atoms:
 using s_get_pos_atom = caf::atom_constant<caf::atom ("S_1")>;
@@ -25,7 +25,28 @@ constexpr int current_procotol_version = 498;
 constexpr const char *main_world_name = "Main";
 
 constexpr int chunk_radius = 4;
+constexpr int world_region_shift = 5; // worlds are split into shards of 32x32 chunks
+constexpr int spawn_chunk_radius = 4; // chunks around the spawn point that are never unloaded
+constexpr unsigned int max_indirect_bits_per_block = 8; // larger sections do not use a palette
+constexpr unsigned int direct_bits_per_block = 14; // bits per block of sections without a palette
 constexpr int max_lighting_updates = 1024;
+constexpr int world_tick_interval_ms = 50;
+constexpr int section_resend_threshold = 512; // changes in one tick after which a whole section is resent
+
+constexpr unsigned int inbound_read_size = 16384; // max bytes per connection read
+constexpr unsigned int max_packet_size = 2097151; // largest length encodable in 3 varint bytes
+constexpr unsigned int max_packet_size_bytes = 3; // max size of a packet length prefix
+
+constexpr int default_flush_interval_ms = 50; // one game tick
+constexpr unsigned int default_flush_threshold = 65536;
+constexpr int default_compression_threshold = 256;
+constexpr unsigned int default_compression_workers = 2;
+constexpr unsigned int default_chunk_encoder_workers = 2; // number of actors encoding chunk packets
+constexpr unsigned int default_world_generator_workers = 2; // number of actors generating chunks
+constexpr unsigned int default_outbound_byte_budget = 2097152; // unsent bytes before packets get held back
+constexpr unsigned int default_outbound_packet_budget = 4096; // max held back packets per client
+constexpr int default_overload_timeout_ms = 10000; // time a client may stay over budget
+constexpr unsigned int default_chunk_memory_budget = 268435456; // bytes of loaded chunks before unused ones are unloaded
 
 constexpr const char *color_escape = "\x07";
 
@@ -70,10 +91,12 @@ enum out_packet_id
   // play state
   OPI_BLOCK_CHANGE = 0x0B,
   OPI_CHAT_MESSAGE = 0x0E,
+  OPI_MULTI_BLOCK_CHANGE = 0x0F,
   OPI_DISCONNECT = 0x1A,
   OPI_UNLOAD_CHUNK = 0x1D,
   OPI_KEEP_ALIVE = 0x20,
   OPI_CHUNK_DATA = 0x21,
+  OPI_UPDATE_LIGHT = 0x24,
   OPI_JOIN_GAME = 0x25,
   OPI_PLAYER_POSITION_AND_LOOK = 0x35,
   OPI_SPAWN_POSITION = 0x4D,
@@ -85,6 +108,7 @@ enum out_packet_id
   // login state
   OPI_DISCONNECT_LOGIN = 0x00,
   OPI_LOGIN_SUCCESS = 0x02,
+  OPI_SET_COMPRESSION = 0x03,
 };
 
 #endif //NOSTALGIA_CONSTS_HPP
@@ -0,0 +1,81 @@
+/*
+ * Nostalgia - A custom Minecraft server.
+ * Copyright (C) 2019  Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef NOSTALGIA_METRICS_HPP
+#define NOSTALGIA_METRICS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <ostream>
+
+
+namespace metrics {
+
+  /*!
+   * \class counter
+   * \brief A monotonically increasing value that can be updated from any actor.
+   */
+  class counter
+  {
+    std::atomic<uint64_t> val { 0 };
+
+   public:
+    inline void add (uint64_t n = 1) { this->val.fetch_add (n, std::memory_order_relaxed); }
+    [[nodiscard]] inline uint64_t get () const { return this->val.load (std::memory_order_relaxed); }
+  };
+
+  /*!
+   * \class gauge
+   * \brief A value that can go up and down. Also remembers the highest value
+   *        it has ever been set to (its high-water mark).
+   */
+  class gauge
+  {
+    std::atomic<int64_t> val { 0 };
+    std::atomic<int64_t> peak { 0 };
+
+   public:
+    void add (int64_t n);
+    inline void sub (int64_t n) { this->add (-n); }
+
+    //! \brief Raises the high-water mark to the specified value without changing the gauge.
+    void observe (int64_t v);
+
+    [[nodiscard]] inline int64_t get () const { return this->val.load (std::memory_order_relaxed); }
+    [[nodiscard]] inline int64_t high_water_mark () const { return this->peak.load (std::memory_order_relaxed); }
+  };
+
+
+  /*!
+   * \brief Returns the counter registered under the specified name, creating
+   *        it if necessary.
+   *
+   * The returned reference stays valid for the lifetime of the program, so
+   * callers should look a counter up once and keep the reference around.
+   */
+  counter& get_counter (const std::string& name);
+
+  //! \brief Returns the gauge registered under the specified name, creating it if necessary.
+  gauge& get_gauge (const std::string& name);
+
+  //! \brief Prints the current value of every registered metric.
+  void dump (std::ostream& out);
+}
+
+#endif //NOSTALGIA_METRICS_HPP
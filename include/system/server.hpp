@@ -26,6 +26,22 @@
 #include <random>
 
 
+/*!
+ * \brief Tunables of the server and its worlds (set from the command line or
+ *        config file, see nostalgia_config).
+ */
+struct server_settings
+{
+  //! Number of actors encoding chunk packets, shared by all worlds.
+  size_t chunk_encoder_workers;
+
+  //! Number of actors generating chunks, shared by all worlds.
+  size_t world_generator_workers;
+
+  //! Bytes of loaded chunks (of all worlds) after which unused chunks are unloaded.
+  size_t chunk_memory_budget;
+};
+
 class server_actor : public caf::event_based_actor
 {
   std::mt19937 rnd;
@@ -36,12 +52,14 @@ class server_actor : public caf::event_based_actor
   bool stopping = false;
 
   caf::actor world_gen;
+  caf::actor chunk_encoder;
   caf::actor script_eng;
 
   unsigned int next_world_id = 1;
+  server_settings settings;
 
  public:
-  explicit server_actor (caf::actor_config& cfg, const caf::actor& script_eng);
+  server_actor (caf::actor_config& cfg, const caf::actor& script_eng, const server_settings& settings);
 
   caf::behavior make_behavior () override;
 
@@ -0,0 +1,142 @@
+/*
+ * Nostalgia - A custom Minecraft server.
+ * Copyright (C) 2019  Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef NOSTALGIA_BITS_HPP
+#define NOSTALGIA_BITS_HPP
+
+#include <cstdint>
+#include <cstring>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NOSTALGIA_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+
+//
+// Byte swapping and unaligned big-endian loads/stores, as used by the
+// network protocol. Loads and stores go through memcpy, which compilers
+// turn into a single (unaligned) move. A little-endian host is assumed.
+//
+
+inline uint16_t
+bswap16 (uint16_t val)
+{
+#ifdef _MSC_VER
+  return _byteswap_ushort (val);
+#else
+  return __builtin_bswap16 (val);
+#endif
+}
+
+inline uint32_t
+bswap32 (uint32_t val)
+{
+#ifdef _MSC_VER
+  return _byteswap_ulong (val);
+#else
+  return __builtin_bswap32 (val);
+#endif
+}
+
+inline uint64_t
+bswap64 (uint64_t val)
+{
+#ifdef _MSC_VER
+  return _byteswap_uint64 (val);
+#else
+  return __builtin_bswap64 (val);
+#endif
+}
+
+inline uint16_t
+load_be16 (const void *src)
+{
+  uint16_t val;
+  std::memcpy (&val, src, 2);
+  return bswap16 (val);
+}
+
+inline uint32_t
+load_be32 (const void *src)
+{
+  uint32_t val;
+  std::memcpy (&val, src, 4);
+  return bswap32 (val);
+}
+
+inline uint64_t
+load_be64 (const void *src)
+{
+  uint64_t val;
+  std::memcpy (&val, src, 8);
+  return bswap64 (val);
+}
+
+inline void
+store_be16 (void *dest, uint16_t val)
+{
+  val = bswap16 (val);
+  std::memcpy (dest, &val, 2);
+}
+
+inline void
+store_be32 (void *dest, uint32_t val)
+{
+  val = bswap32 (val);
+  std::memcpy (dest, &val, 4);
+}
+
+inline void
+store_be64 (void *dest, uint64_t val)
+{
+  val = bswap64 (val);
+  std::memcpy (dest, &val, 8);
+}
+
+//! \brief Returns the index of the lowest set bit in a non-zero value.
+inline unsigned int
+lowest_bit64 (uint64_t val)
+{
+#ifdef _MSC_VER
+  unsigned long idx;
+  _BitScanForward64 (&idx, val);
+  return (unsigned int)idx;
+#else
+  return (unsigned int)__builtin_ctzll (val);
+#endif
+}
+
+//! \brief Returns the index of the highest set bit in a non-zero value.
+inline unsigned int
+highest_bit64 (uint64_t val)
+{
+#ifdef _MSC_VER
+  unsigned long idx;
+  _BitScanReverse64 (&idx, val);
+  return (unsigned int)idx;
+#else
+  return 63 - (unsigned int)__builtin_clzll (val);
+#endif
+}
+
+#endif //NOSTALGIA_BITS_HPP
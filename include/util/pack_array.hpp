@@ -20,51 +20,196 @@
 #define NOSTALGIA_PACK_ARRAY_HPP
 
 #include <cstddef>
+#include <cstdint>
+#include <utility>
+#include "util/bits.hpp"
+
+
+//
+// Packing of small integers into arrays of 64-bit words, as used by the
+// network protocol (chunk sections and height maps): every element takes
+// a fixed number of bits, elements are stored least significant bits first
+// and may span two words.
+//
+// Elements are processed in blocks of 64, which take up exactly as many
+// words as there are bits per element. Within a block the word and shift
+// of every element are compile-time constants.
+//
+
+namespace pack_detail {
+
+  template<unsigned int Bits, size_t I>
+  inline void
+  pack_one (const unsigned short *in, uint64_t *out)
+  {
+    constexpr unsigned int bit = I * Bits;
+    constexpr unsigned int word = bit >> 6;
+    constexpr unsigned int shift = bit & 63;
+    constexpr uint64_t mask = (1ULL << Bits) - 1;
+
+    uint64_t val = in[I] & mask;
+    out[word] |= val << shift;
+    if constexpr (shift + Bits > 64)
+      out[word + 1] |= val >> (64 - shift);
+  }
+
+  template<unsigned int Bits, size_t... I>
+  inline void
+  pack_block (const unsigned short *in, uint64_t *out, std::index_sequence<I...>)
+  {
+    for (unsigned int w = 0; w < Bits; ++w)
+      out[w] = 0;
+    (pack_one<Bits, I> (in, out), ...);
+  }
+
+  template<unsigned int Bits, size_t I>
+  inline void
+  unpack_one (const uint64_t *in, unsigned short *out)
+  {
+    constexpr unsigned int bit = I * Bits;
+    constexpr unsigned int word = bit >> 6;
+    constexpr unsigned int shift = bit & 63;
+    constexpr uint64_t mask = (1ULL << Bits) - 1;
+
+    uint64_t val = in[word] >> shift;
+    if constexpr (shift + Bits > 64)
+      val |= in[word + 1] << (64 - shift);
+    out[I] = (unsigned short)(val & mask);
+  }
+
+  template<unsigned int Bits, size_t... I>
+  inline void
+  unpack_block (const uint64_t *in, unsigned short *out, std::index_sequence<I...>)
+  {
+    (unpack_one<Bits, I> (in, out), ...);
+  }
+
+#ifdef NOSTALGIA_HAVE_SSE2
+  // 8 bits per element: every element is one byte of the output.
+  inline void
+  pack_block_8_sse2 (const unsigned short *in, uint64_t *out)
+  {
+    auto mask = _mm_set1_epi16 (0xFF);
+    auto dest = reinterpret_cast<__m128i *> (out);
+    for (int i = 0; i < 4; ++i)
+      {
+        auto a = _mm_and_si128 (_mm_loadu_si128 ((const __m128i *)(in + i * 16)), mask);
+        auto b = _mm_and_si128 (_mm_loadu_si128 ((const __m128i *)(in + i * 16 + 8)), mask);
+        _mm_storeu_si128 (dest + i, _mm_packus_epi16 (a, b));
+      }
+  }
+
+  inline void
+  unpack_block_8_sse2 (const uint64_t *in, unsigned short *out)
+  {
+    auto zero = _mm_setzero_si128 ();
+    auto src = reinterpret_cast<const __m128i *> (in);
+    for (int i = 0; i < 4; ++i)
+      {
+        auto bytes = _mm_loadu_si128 (src + i);
+        _mm_storeu_si128 ((__m128i *)(out + i * 16), _mm_unpacklo_epi8 (bytes, zero));
+        _mm_storeu_si128 ((__m128i *)(out + i * 16 + 8), _mm_unpackhi_epi8 (bytes, zero));
+      }
+  }
+
+  // 4 bits per element: every byte of the output holds two elements.
+  inline void
+  pack_block_4_sse2 (const unsigned short *in, uint64_t *out)
+  {
+    auto mask = _mm_set1_epi16 (0x0F);
+    auto low_byte = _mm_set1_epi16 (0xFF);
+    auto dest = reinterpret_cast<char *> (out);
+    for (int i = 0; i < 4; ++i)
+      {
+        auto a = _mm_and_si128 (_mm_loadu_si128 ((const __m128i *)(in + i * 16)), mask);
+        auto b = _mm_and_si128 (_mm_loadu_si128 ((const __m128i *)(in + i * 16 + 8)), mask);
+        auto bytes = _mm_packus_epi16 (a, b); // 16 elements, one per byte
+
+        // merge every pair of bytes into one
+        auto merged = _mm_or_si128 (_mm_and_si128 (bytes, low_byte),
+                                    _mm_slli_epi16 (_mm_srli_epi16 (bytes, 8), 4));
+        _mm_storel_epi64 ((__m128i *)(dest + i * 8), _mm_packus_epi16 (merged, merged));
+      }
+  }
+
+  inline void
+  unpack_block_4_sse2 (const uint64_t *in, unsigned short *out)
+  {
+    auto zero = _mm_setzero_si128 ();
+    auto mask = _mm_set1_epi8 (0x0F);
+    auto src = reinterpret_cast<const char *> (in);
+    for (int i = 0; i < 4; ++i)
+      {
+        auto bytes = _mm_loadl_epi64 ((const __m128i *)(src + i * 8));
+        auto lo = _mm_and_si128 (bytes, mask);
+        auto hi = _mm_and_si128 (_mm_srli_epi16 (bytes, 4), mask);
+        auto nibbles = _mm_unpacklo_epi8 (lo, hi); // 16 elements, one per byte
+        _mm_storeu_si128 ((__m128i *)(out + i * 16), _mm_unpacklo_epi8 (nibbles, zero));
+        _mm_storeu_si128 ((__m128i *)(out + i * 16 + 8), _mm_unpackhi_epi8 (nibbles, zero));
+      }
+  }
+#endif
+}
 
 
 /*!
- * Packs the elements into the specified output array in such a way that in
- * the output array every element takes \p bits_per_element bits of space.
- *
- * \tparam T The element type of the input array.
- * \tparam U The element type of the output array.
- * \param elements The array to pack.
- * \param bits_per_element Number bits of space each element will take in the output array.
- * \param out The array to save the results into.
+ * \brief Packs elements into 64-bit words, Bits bits per element.
+ * \param len Number of elements, must be a multiple of 64.
+ * \param out Receives len * Bits / 64 words.
  */
-template<typename T, typename U>
-void pack_array (const T *in, size_t in_len, U *out, unsigned int bits_per_element)
+template<unsigned int Bits>
+void
+pack_bits (const unsigned short *in, size_t len, uint64_t *out)
 {
-  constexpr auto output_cell_size = sizeof (U) * 8;
+  static_assert (Bits >= 1 && Bits <= 16, "unsupported element width");
+  for (size_t i = 0; i < len; i += 64, in += 64, out += Bits)
+    {
+#ifdef NOSTALGIA_HAVE_SSE2
+      if constexpr (Bits == 8)
+        pack_detail::pack_block_8_sse2 (in, out);
+      else if constexpr (Bits == 4)
+        pack_detail::pack_block_4_sse2 (in, out);
+      else
+#endif
+        pack_detail::pack_block<Bits> (in, out, std::make_index_sequence<64> ());
+    }
+}
 
-  U curr = 0;
-  unsigned curr_offset = 0;
-  unsigned int len = 0;
-  for (size_t i = 0; i < in_len; ++i)
+/*!
+ * \brief Unpacks elements packed by pack_bits.
+ * \param len Number of elements, must be a multiple of 64.
+ */
+template<unsigned int Bits>
+void
+unpack_bits (const uint64_t *in, size_t len, unsigned short *out)
+{
+  static_assert (Bits >= 1 && Bits <= 16, "unsupported element width");
+  for (size_t i = 0; i < len; i += 64, in += Bits, out += 64)
     {
-      int val = in[i];
-
-      // determine how many bits to occupy in current output element
-      unsigned take = bits_per_element;
-      if (output_cell_size - curr_offset < take)
-        take = output_cell_size - curr_offset;
-
-      auto head = val >> (bits_per_element - take);
-      auto tail = val & ((1 << (bits_per_element - take)) - 1);
-
-      curr <<= take;
-      curr |= head;
-      curr_offset += take;
-      if (curr_offset == output_cell_size)
-        {
-          // filled an output cell
-          out[len++] = curr;
-
-          // move remainder to next cell if there is one
-          curr_offset = bits_per_element - take;
-          curr = tail;
-        }
+#ifdef NOSTALGIA_HAVE_SSE2
+      if constexpr (Bits == 8)
+        pack_detail::unpack_block_8_sse2 (in, out);
+      else if constexpr (Bits == 4)
+        pack_detail::unpack_block_4_sse2 (in, out);
+      else
+#endif
+        pack_detail::unpack_block<Bits> (in, out, std::make_index_sequence<64> ());
     }
 }
 
+
+/*!
+ * \brief Packs elements into 64-bit words, picking the kernel specialized
+ *        for the specified number of bits per element (1-16).
+ * \param len Number of elements, must be a multiple of 64.
+ * \param out Receives len * bits_per_element / 64 words.
+ */
+void pack_array (const unsigned short *in, size_t len, uint64_t *out, unsigned int bits_per_element);
+
+/*!
+ * \brief Unpacks elements packed by pack_array.
+ * \param len Number of elements, must be a multiple of 64.
+ */
+void unpack_array (const uint64_t *in, size_t len, unsigned short *out, unsigned int bits_per_element);
+
 #endif //NOSTALGIA_PACK_ARRAY_HPP
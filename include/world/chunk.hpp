@@ -20,57 +20,200 @@
 #define NOSTALGIA_CHUNK_HPP
 
 #include <vector>
-#include <map>
 #include <memory>
+#include <cstdint>
+#include <caf/all.hpp>
 #include "network/packet_writer.hpp"
 
 
-struct chunk_palette
+/*!
+ * \class chunk_section
+ * \brief A 16x16x16 cube of blocks, stored the way it is sent to clients.
+ *
+ * Blocks are kept as indices into a palette of block ids, packed into
+ * 64-bit words least significant bits first (an index may span two words).
+ * Blocks are indexed by (y << 8) | (z << 4) | x.
+ *
+ * The number of bits per index starts at 4 and grows as the palette fills
+ * up. Past max_indirect_bits_per_block the palette is dropped and block ids
+ * are stored directly, using direct_bits_per_block bits each.
+ *
+ * Light arrays (two light levels per byte) are only allocated once a
+ * section stops having the same light level everywhere.
+ *
+ * Sections may be shared between chunks and threads (see section_pool).
+ * Shared sections are never modified, chunks copy them first.
+ */
+class chunk_section
 {
-  std::vector<unsigned short> ids;
-  std::map<unsigned short, unsigned short> index_map;
+  std::vector<unsigned short> palette; // empty in direct mode
+  std::vector<uint64_t> data;
+  unsigned int bits;
+  int non_air = 0; // number of blocks that are not air
 
-  unsigned int num_blocks () const { return (unsigned)ids.size (); }
-  unsigned int compute_bits_per_block () const;
-};
+  std::vector<unsigned char> block_light; // empty while all levels are block_light_fill
+  std::vector<unsigned char> sky_light; // empty while all levels are sky_light_fill
+  unsigned char block_light_fill = 0;
+  unsigned char sky_light_fill = 0;
 
-struct chunk_section
-{
-  unsigned short ids[4096];
-  unsigned char block_light[2048];
-  unsigned char sky_light[2048];
+  // the section's encoded form (reset when its blocks change, light is not
+  // part of it), and whether the section was put in the section pool. copies
+  // of a section keep its encoded form but are never pooled.
+  struct shared_state
+  {
+    std::shared_ptr<const std::vector<char>> encoded; // accessed atomically
+    bool pooled = false;
 
+    shared_state () = default;
+    shared_state (const shared_state& other);
+    shared_state& operator= (const shared_state& other);
+  };
+  mutable shared_state shared;
+
+ public:
+  //! \brief Creates a section filled with air and no light.
   chunk_section ();
 
-  [[nodiscard]] chunk_palette generate_palette () const;
+  /*!
+   * \brief Returns the shared section that stands in for sections that are
+   *        not present in a chunk: all air, with full sky light.
+   *
+   * The returned section must never be modified (see chunk::own_section).
+   */
+  static const std::shared_ptr<chunk_section>& empty ();
+
+  [[nodiscard]] inline unsigned int get_bits_per_block () const { return this->bits; }
+  [[nodiscard]] inline bool is_direct () const { return this->palette.empty (); }
+  [[nodiscard]] inline const auto& get_palette () const { return this->palette; }
+  [[nodiscard]] inline const auto& get_data () const { return this->data; }
+
+  [[nodiscard]] unsigned short get_id (unsigned int idx) const;
+  void set_id (unsigned int idx, unsigned short id);
+
+  //! \brief Copies all 4096 block ids into the specified array.
+  void get_ids (unsigned short *out) const;
+
+  //! \brief Replaces all blocks in the section with the 4096 specified block ids.
+  void set_ids (const unsigned short *ids);
 
   //! \brief Returns the number of non air blocks present in the section.
-  [[nodiscard]] int count_non_air_blocks () const;
+  [[nodiscard]] inline int count_non_air_blocks () const { return this->non_air; }
 
-  template<typename Inspector>
-  friend typename Inspector::result_type
-  inspect (Inspector& f, chunk_section& cs)
-  {
-    return f (caf::meta::type_name ("chunk_section"), cs.ids, cs.block_light, cs.sky_light);
-  }
+  [[nodiscard]] unsigned char get_block_light (unsigned int idx) const;
+  void set_block_light (unsigned int idx, unsigned char val);
+  [[nodiscard]] unsigned char get_sky_light (unsigned int idx) const;
+  void set_sky_light (unsigned int idx, unsigned char val);
+
+  //! \brief Returns the packed block light levels, or an empty array if they are all get_block_light_fill ().
+  [[nodiscard]] inline const auto& get_block_light_data () const { return this->block_light; }
+  [[nodiscard]] inline unsigned char get_block_light_fill () const { return this->block_light_fill; }
+
+  //! \brief Returns the packed sky light levels, or an empty array if they are all get_sky_light_fill ().
+  [[nodiscard]] inline const auto& get_sky_light_data () const { return this->sky_light; }
+  [[nodiscard]] inline unsigned char get_sky_light_fill () const { return this->sky_light_fill; }
+
+  //! \brief Checks whether every block has the same block and sky light level.
+  [[nodiscard]] inline bool has_uniform_light () const
+  { return this->block_light.empty () && this->sky_light.empty (); }
+
+  //! \brief Checks whether the section is lit like sections that are not present: full sky light, no block light.
+  [[nodiscard]] inline bool has_default_light () const
+  { return this->has_uniform_light () && this->sky_light_fill == 15 && this->block_light_fill == 0; }
+
+  /*!
+   * \brief Returns the section the way it appears in CHUNK DATA packets.
+   *
+   * The encoding is cached in the section, so every section (and every
+   * chunk sharing it) is only encoded once. Safe to call from any thread
+   * while the section is shared.
+   */
+  [[nodiscard]] std::shared_ptr<const std::vector<char>> encode () const;
+
+  //! \brief Returns a hash of the section's blocks and light.
+  [[nodiscard]] uint64_t hash () const;
+
+  //! \brief Checks whether two sections hold the same blocks and light, stored the same way.
+  bool operator== (const chunk_section& other) const;
+
+  //! \brief Returns an estimate of the memory taken up by the section, in bytes.
+  [[nodiscard]] size_t memory_usage () const;
+
+  //! \brief Checks whether the section is in the section pool (which means it must not be modified).
+  [[nodiscard]] inline bool is_pooled () const { return this->shared.pooled; }
+  inline void mark_pooled () { this->shared.pooled = true; }
+
+ private:
+  //! \brief Repacks the section using the specified number of bits per block.
+  void repack (unsigned int new_bits);
+};
+
+/*!
+ * \brief Height maps kept up to date by chunks.
+ */
+enum class height_map_type
+{
+  motion_blocking, //!< highest block that blocks motion
+  world_surface,   //!< highest block that is not air
 };
 
+constexpr int num_height_map_types = 2;
+
+/*!
+ * \class chunk
+ * \brief A 16x256x16 column of blocks, made of 16 sections.
+ *
+ * Sections are reference counted and copied on write, so copies of a chunk
+ * share their sections until they are modified. Sections that are not
+ * present (see section_bitmap) all share chunk_section::empty (), and
+ * pool_sections () shares identical sections between chunks.
+ */
 class chunk
 {
   int x, z;
   int biomes[256] = { 0 };
-  std::vector<chunk_section> sections;
+  std::shared_ptr<chunk_section> sections[16];
   unsigned int section_bitmap = 0;
   bool dirty = true; // tracks whether changes have been made to this chunk
+  uint64_t version = 0; // bumped whenever a section is handed out for modification
+
+  // encoded form of the height map, as it appears in CHUNK DATA packets.
+  // (sections cache their own encoding)
+  std::vector<char> heightmap_cache;
+  bool heightmap_cached = false;
+
+  // one plus the y coordinate of the highest matching block in every column
+  // (indexed z * 16 + x, 0 if there is none), per height map type. updated
+  // as blocks are set, and rebuilt when sections are modified directly.
+  unsigned short height_maps[num_height_map_types][256];
+  bool height_maps_valid = true;
 
  public:
   [[nodiscard]] inline int get_x () const { return this->x; }
   [[nodiscard]] inline int get_z () const { return this->z; }
   [[nodiscard]] inline bool has_section (unsigned idx) const { return this->section_bitmap & (1U << idx); }
-  [[nodiscard]] inline const auto& get_section (unsigned idx) const { return this->sections[idx]; }
-  [[nodiscard]] inline auto& get_section (unsigned idx) { return this->sections[idx]; }
+  [[nodiscard]] inline const chunk_section& get_section (unsigned idx) const { return *this->sections[idx]; }
+  [[nodiscard]] inline chunk_section& get_section (unsigned idx) { this->invalidate_height_maps (); return this->own_section (idx); }
   [[nodiscard]] inline auto get_section_bitmap () const { return this->section_bitmap; }
-  inline void add_section (unsigned idx) { this->section_bitmap |= (1U << idx); }
+
+  //! \brief Marks a section as present, creating one like chunk_section::empty () if necessary.
+  void add_section (unsigned idx);
+
+  //! \brief Frees the specified section if it holds nothing but air and has default light.
+  void release_if_empty (unsigned idx);
+
+  //! \brief Replaces the chunk's sections with identical ones from the section pool, if there are any.
+  void pool_sections ();
+
+  //! \brief Returns a number that changes whenever the chunk's blocks or light may have changed.
+  [[nodiscard]] inline uint64_t get_version () const { return this->version; }
+
+  /*!
+   * \brief Returns an estimate of the memory taken up by the chunk, in bytes.
+   *
+   * Pooled sections are shared with other chunks and stay in memory as long
+   * as any of them does, so they are not counted.
+   */
+  [[nodiscard]] size_t memory_usage () const;
 
   [[nodiscard]] inline bool is_dirty () const { return this->dirty; }
   inline void mark_dirty (bool value = true) { this->dirty = value; }
@@ -93,20 +236,63 @@ class chunk
   //! \brief Computes sky/block lighting for the blocks in chunk.
   void compute_initial_lighting ();
 
-  //! \brief Fills the specified height map array with the correct values.
-  void compute_height_map (int height_map[256]);
+  /*!
+   * \brief Returns one plus the y coordinate of the highest block in the
+   *        specified column that counts towards the given height map,
+   *        or 0 if there is no such block.
+   */
+  unsigned short get_height (height_map_type type, int x, int z);
+
+  //! \brief Returns the y coordinate of the highest non transparent block in the specified column, or -1.
+  inline int get_highest_block (int x, int z)
+  { return (int)this->get_height (height_map_type::motion_blocking, x, z) - 1; }
 
   /*!
    * \brief Creates a CHUNK DATA packet to send to a client.
+   *
+   * Sections and the height map are encoded once and cached until blocks in
+   * them change, so sending an unchanged chunk again mostly copies bytes.
+   * Sections shared between chunks share their encoding too.
+   * \param section_mask Sections to include. When not all sections are
+   *        requested, a partial (non full chunk) packet is made that only
+   *        replaces the selected sections on the client.
+   */
+  packet_writer make_chunk_data_packet (unsigned int section_mask = 0xFFFF);
+
+  /*!
+   * \brief Creates an UPDATE LIGHT packet holding the sky and block light of
+   *        the specified sections.
+   *
+   * CHUNK DATA packets carry no light, so this is sent along with them, and
+   * on its own for sections whose light changed.
    */
-  packet_writer make_chunk_data_packet ();
+  packet_writer make_update_light_packet (unsigned int section_mask = 0xFFFF);
+
+ private:
+  //! \brief Returns a section that can be modified, copying it first if it is shared.
+  chunk_section& own_section (unsigned idx);
 
-  template<typename Inspector>
-  friend typename Inspector::result_type
-  inspect (Inspector& f, chunk& ch)
+  //! \brief Marks the height maps as stale, they are rebuilt the next time they are needed.
+  inline void invalidate_height_maps ()
   {
-    return f (caf::meta::type_name ("chunk"), ch.x, ch.z, ch.sections, ch.biomes);
+    this->height_maps_valid = false;
+    this->heightmap_cached = false;
   }
+
+  //! \brief Recomputes all height maps from scratch.
+  void rebuild_height_maps ();
+
+  //! \brief Updates the height maps after the block at the specified position was changed.
+  void update_height_maps (int x, int y, int z, unsigned short id);
+
+  //! \brief Scans the column down from y for the highest block that counts towards the given height map.
+  unsigned short scan_height (height_map_type type, int x, int y, int z);
+
+  //! \brief Returns the cached height map NBT, creating it if necessary.
+  const std::vector<char>& encode_height_map ();
 };
 
+// chunks are only ever passed between actors in the same process.
+CAF_ALLOW_UNSAFE_MESSAGE_TYPE(chunk)
+
 #endif //NOSTALGIA_CHUNK_HPP
@@ -0,0 +1,39 @@
+/*
+ * Nostalgia - A custom Minecraft server.
+ * Copyright (C) 2019  Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef NOSTALGIA_CHUNK_ENCODER_HPP
+#define NOSTALGIA_CHUNK_ENCODER_HPP
+
+#include <caf/all.hpp>
+
+
+/*!
+ * \brief Behavior of the actors that encode chunks for players on behalf of
+ *        worlds, so that joining players do not hold up the world actor.
+ *
+ * Handles (encode_chunk_atom, chunk, broker): the chunk is a snapshot taken
+ * by the world (sections are shared with the world's copy and copied on
+ * write, so taking it is cheap). The packets are sent straight to the
+ * broker, and the sender is answered with (chunk_encoded_atom, x, z,
+ * version, broker).
+ *
+ * Usually spawned as a pool of workers.
+ */
+caf::behavior chunk_encoder_impl (caf::event_based_actor *self);
+
+#endif //NOSTALGIA_CHUNK_ENCODER_HPP
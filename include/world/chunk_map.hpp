@@ -0,0 +1,110 @@
+/*
+ * Nostalgia - A custom Minecraft server.
+ * Copyright (C) 2019  Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef NOSTALGIA_CHUNK_MAP_HPP
+#define NOSTALGIA_CHUNK_MAP_HPP
+
+#include "world/chunk.hpp"
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+
+//! \brief Packs chunk coordinates into a single 64-bit key.
+inline uint64_t
+pack_chunk_key (int cx, int cz)
+{
+  return ((uint64_t)(uint32_t)cx << 32) | (uint32_t)cz;
+}
+
+/*!
+ * \class chunk_map
+ * \brief Hash map from chunk coordinates to chunks.
+ *
+ * Uses open addressing with linear probing over a flat array of slots
+ * keyed by packed coordinates (see pack_chunk_key), so a lookup usually
+ * touches a single cache line. Erasing shifts entries back instead of
+ * leaving tombstones.
+ *
+ * The chunk returned by the last successful lookup is remembered, as block
+ * and light accesses tend to hit the same chunk many times in a row.
+ */
+class chunk_map
+{
+  struct slot
+  {
+    uint64_t key = 0;
+    std::unique_ptr<chunk> ch; // null if the slot is free
+  };
+
+  std::vector<slot> slots; // size is a power of two
+  unsigned int shift; // 64 - log2 (number of slots)
+  size_t count = 0;
+
+  // last chunk found
+  uint64_t last_key = 0;
+  chunk *last = nullptr;
+
+ public:
+  chunk_map ();
+
+  [[nodiscard]] inline size_t size () const { return this->count; }
+  [[nodiscard]] inline bool empty () const { return this->count == 0; }
+
+  //! \brief Returns the chunk at the specified coordinates, or null if there is none.
+  inline chunk* find (int cx, int cz)
+  {
+    auto key = pack_chunk_key (cx, cz);
+    if (this->last && this->last_key == key)
+      return this->last;
+    return this->find_slow (key);
+  }
+
+  /*!
+   * \brief Inserts a chunk at the specified coordinates.
+   * \return The chunk stored at the coordinates: the one that was passed,
+   *         or the one that was already there (in which case the passed
+   *         chunk is discarded).
+   */
+  chunk* insert (int cx, int cz, std::unique_ptr<chunk> ch);
+
+  //! \brief Removes (and destroys) the chunk at the specified coordinates, if there is one.
+  bool erase (int cx, int cz);
+
+  //! \brief Calls the specified function with every chunk in the map.
+  template<typename Fn>
+  void for_each (Fn&& fn)
+  {
+    for (auto& s : this->slots)
+      if (s.ch)
+        fn (*s.ch);
+  }
+
+ private:
+  //! \brief Returns the slot a key would ideally be stored in.
+  [[nodiscard]] inline size_t home (uint64_t key) const
+  { return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> this->shift); }
+
+  chunk* find_slow (uint64_t key);
+
+  //! \brief Doubles the number of slots.
+  void grow ();
+};
+
+#endif //NOSTALGIA_CHUNK_MAP_HPP
@@ -0,0 +1,64 @@
+/*
+ * Nostalgia - A custom Minecraft server.
+ * Copyright (C) 2019  Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef NOSTALGIA_PALETTE_HPP
+#define NOSTALGIA_PALETTE_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+//! \brief Returns the number of bits per block needed for a palette of the specified size.
+unsigned int palette_bits_per_block (unsigned int num_blocks);
+
+/*!
+ * \class palette_builder
+ * \brief Builds block palettes in a single pass over an array of block ids.
+ *
+ * Uses a flat table over the whole block id space that maps ids to their
+ * palette index. Every entry is stamped with the generation (build) it was
+ * written in, so the table never has to be cleared between builds.
+ *
+ * The table takes 256 KB, so builders should be reused (see local ()).
+ */
+class palette_builder
+{
+  std::vector<uint32_t> table; // generation << 16 | palette index, per block id
+  uint32_t generation = 0;
+
+ public:
+  palette_builder ();
+
+  //! \brief Returns a builder owned by the calling thread.
+  static palette_builder& local ();
+
+  /*!
+   * \brief Builds the palette of the specified block ids.
+   *
+   * \param ids The block ids to build a palette for.
+   * \param count Number of block ids.
+   * \param palette Receives the distinct block ids, in order of appearance.
+   * \param indices Receives the palette index of every block (count entries).
+   * \return The number of entries in the palette.
+   */
+  unsigned int build (const unsigned short *ids, size_t count,
+                      std::vector<unsigned short>& palette, unsigned short *indices);
+};
+
+#endif //NOSTALGIA_PALETTE_HPP
@@ -21,6 +21,7 @@
 
 #include <string>
 #include <memory>
+#include <mutex>
 #include "world/chunk.hpp"
 
 
@@ -55,6 +56,27 @@ class world_provider
 };
 
 
+/*!
+ * \class synchronized_world_provider
+ * \brief Wraps a provider so that it can be used from several actors at once
+ *        (e.g. the shards of a world), serializing all calls to it.
+ */
+class synchronized_world_provider : public world_provider
+{
+  std::mutex mtx;
+  std::unique_ptr<world_provider> prov;
+
+ public:
+  explicit synchronized_world_provider (std::unique_ptr<world_provider> prov);
+
+  void open (const std::string& path) override;
+  void close () override;
+  bool can_load_chunk (int cx, int cz) override;
+  chunk load_chunk (int cx, int cz) override;
+  void save_chunk (chunk& ch) override;
+};
+
+
 /*!
  * \brief Creates a new world provider for the specified world format (name).
  */
@@ -0,0 +1,64 @@
+/*
+ * Nostalgia - A custom Minecraft server.
+ * Copyright (C) 2019  Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef NOSTALGIA_SECTION_POOL_HPP
+#define NOSTALGIA_SECTION_POOL_HPP
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+
+
+// forward decs:
+class chunk_section;
+
+/*!
+ * \class section_pool
+ * \brief Deduplicates chunk sections by content.
+ *
+ * Chunks made of the same sections (as generated terrain usually is) end
+ * up sharing a single copy of each distinct section, along with its
+ * encoded form. Pooled sections are never modified: chunks copy them
+ * before changing them.
+ *
+ * The pool only holds weak references, so sections are freed as soon as
+ * no chunk uses them anymore. Can be used from any thread.
+ */
+class section_pool
+{
+  std::mutex mtx;
+  std::unordered_multimap<uint64_t, std::weak_ptr<chunk_section>> sections; // by content hash
+  size_t inserts_since_sweep = 0;
+
+ public:
+  //! \brief Returns the pool shared by all worlds.
+  static section_pool& global ();
+
+  /*!
+   * \brief Returns a pooled section identical to the specified one, adding
+   *        the section to the pool if there is none.
+   */
+  std::shared_ptr<chunk_section> intern (const std::shared_ptr<chunk_section>& section);
+
+ private:
+  //! \brief Drops entries of sections that no longer exist.
+  void sweep ();
+};
+
+#endif //NOSTALGIA_SECTION_POOL_HPP
@@ -21,63 +21,62 @@
 
 #include "system/consts.hpp"
 #include "system/info.hpp"
-#include "world/chunk.hpp"
 #include <string>
 #include <map>
 #include <utility>
-#include <stack>
+#include <memory>
 #include <caf/all.hpp>
 
 
 // forward decs:
 class world_provider;
 
-struct lighting_update
-{
-  block_pos pos;
-};
-
-class world : public caf::blocking_actor
+/*!
+ * \class world
+ * \brief A world, as seen by players, scripts and the server.
+ *
+ * The world's chunks are owned by shards (see world_shard), one per region
+ * of 32x32 chunks, spawned as they are first needed. The world itself only
+ * keeps track of its players and routes chunk requests, block changes and
+ * script queries to the shard owning the chunk involved.
+ */
+class world : public caf::event_based_actor
 {
   world_info info;
-  std::map<std::pair<int, int>, std::unique_ptr<chunk>> chunks;
+
+  // brokers of players in this world, keyed by client actor.
+  std::map<caf::actor_addr, caf::actor> players;
+
+  // shards by region coordinates.
+  std::map<std::pair<int, int>, caf::actor> shards;
 
   caf::actor srv;
   caf::actor script_eng;
   caf::actor world_gen;
+  caf::actor chunk_encoder;
 
-  std::stack<lighting_update> lighting_updates;
-
-  std::unique_ptr<world_provider> provider;
+  std::shared_ptr<world_provider> provider;
+  size_t chunk_memory_budget;
 
  public:
   [[nodiscard]] inline typed_id get_typed_id () const { return { actor_type::world, this->info.id }; }
 
   world (caf::actor_config& cfg, unsigned int id, const std::string& name,
-      const caf::actor& srv, const caf::actor& script_eng, const caf::actor& world_gen);
+      const caf::actor& srv, const caf::actor& script_eng, const caf::actor& world_gen,
+      const caf::actor& chunk_encoder, size_t chunk_memory_budget);
 
-  virtual void act () override;
+  caf::behavior make_behavior () override;
+  void on_exit () override;
 
  private:
-  //! \brief Handles actor messages.
-  void handle_messages ();
-
-  //! \brief Processes queued sky/block lighting updates
-  void handle_lighting (int max_updates=max_lighting_updates);
-
-  //! \brief Delegates changes made to the world to the world's provider.
-  void save ();
-
-  chunk* find_chunk (int cx, int cz);
-
-  //! \brief Attempts to load a chunk at the specified coordinates.
-  chunk* load_chunk (int cx, int cz);
+  //! \brief Returns the shard owning the specified chunk, spawning it if necessary.
+  caf::actor get_shard (int cx, int cz);
 
-  void set_block_id (int x, int y, int z, unsigned short id);
-  unsigned short get_block_id (int x, int y, int z);
+  //! \brief Returns the shard owning the specified chunk, or an invalid handle if it has not been spawned.
+  caf::actor find_shard (int cx, int cz);
 
-  void set_sky_light (int x, int y, int z, unsigned char val);
-  unsigned char get_sky_light (int x, int y, int z);
+  //! \brief Saves and stops all shards, then stops the world.
+  void stop (const caf::actor& requester);
 };
 
 #endif //NOSTALGIA_WORLD_HPP
@@ -0,0 +1,239 @@
+/*
+ * Nostalgia - A custom Minecraft server.
+ * Copyright (C) 2019  Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef NOSTALGIA_WORLD_SHARD_HPP
+#define NOSTALGIA_WORLD_SHARD_HPP
+
+#include "system/consts.hpp"
+#include "util/position.hpp"
+#include "world/chunk.hpp"
+#include "world/chunk_map.hpp"
+#include <string>
+#include <map>
+#include <set>
+#include <utility>
+#include <stack>
+#include <list>
+#include <vector>
+#include <memory>
+#include <caf/all.hpp>
+
+
+// forward decs:
+class world_provider;
+class packet_buffer;
+
+struct lighting_update
+{
+  block_pos pos;
+};
+
+//! \brief Bookkeeping for a loaded chunk.
+struct chunk_residency
+{
+  size_t bytes; // last known memory usage (see chunk::memory_usage)
+  bool unused; // whether the chunk is in the shard's unused list
+  std::list<std::pair<int, int>>::iterator lru_pos; // position in the unused list
+};
+
+/*!
+ * \class world_shard
+ * \brief Owns the chunks of a single region of a world (see world_region_shift).
+ *
+ * Shards are spawned by their world (which routes messages to them) and run
+ * independently of each other, so a world can make use of several cores.
+ * All chunk state (subscribers, pending block and light changes) is kept by
+ * the shard owning the chunk.
+ *
+ * Shards only modify the chunks of their own region. Lighting updates that
+ * spread into a neighbouring region are handed off to the world as
+ * lighting_update_atom messages, which forwards them to the shard owning
+ * the position.
+ *
+ * Reads past the region's border (made while lighting) are served from
+ * read-only snapshots of the chunks on the other side, which shards share
+ * with their neighbours (again through the world) whenever a chunk on
+ * their border is loaded or changes. A border chunk's snapshot is always
+ * shared before any lighting update handed off from it, so the neighbour
+ * sees the light the update was computed from. Reads of chunks that have
+ * no snapshot act as if the chunk was not loaded. Snapshots are dropped
+ * when the chunk they were taken of is unloaded.
+ *
+ * Chunks are in use while players have them loaded, while scripts pin them,
+ * and while they are in the spawn area. Chunks that are not are unloaded,
+ * least recently used first, once the chunks loaded by all shards take up
+ * more memory than the configured budget.
+ */
+class world_shard : public caf::event_based_actor
+{
+  int rx, rz; // region coordinates
+  caf::actor world_actor; // the world routing messages to this shard
+  chunk_map chunks;
+
+  // players that have a chunk loaded (mapped to their brokers), and the reverse mapping.
+  std::map<std::pair<int, int>, std::map<caf::actor_addr, caf::actor>> chunk_subscribers;
+  std::map<caf::actor_addr, std::set<std::pair<int, int>>> subscriptions;
+
+  // block changes made during the current tick, keyed by chunk and then by
+  // position within the chunk (y << 8 | x << 4 | z).
+  std::map<std::pair<int, int>, std::map<unsigned short, unsigned short>> block_changes;
+
+  // sections whose light changed during the current tick, per chunk.
+  std::map<std::pair<int, int>, unsigned int> light_changes;
+
+  caf::actor script_eng;
+  caf::actor world_gen;
+  caf::actor chunk_encoder;
+
+  // chunks that are being generated, with the brokers of the players waiting for them.
+  std::map<std::pair<int, int>, std::vector<caf::actor>> pending_chunks;
+
+  // versions of chunks that are being encoded for players, by chunk and broker.
+  std::map<std::pair<int, int>, std::map<caf::actor, uint64_t>> chunks_in_flight;
+
+  std::stack<lighting_update> lighting_updates;
+
+  // lighting updates for other regions, handed off once the current batch
+  // of updates has been processed (after sharing the border chunks they
+  // were computed from).
+  std::vector<block_pos> lighting_handoffs;
+
+  // snapshots of chunks in neighbouring regions, next to this region's
+  // border, and border chunks of this region that changed since they were
+  // last shared.
+  chunk_map border_chunks;
+  std::set<std::pair<int, int>> changed_border_chunks;
+
+  std::shared_ptr<world_provider> provider; // shared by all shards of the world
+
+  // chunks pinned by scripts, with pin counts. pins outlive the chunk being loaded.
+  std::map<std::pair<int, int>, unsigned int> pins;
+
+  std::map<std::pair<int, int>, chunk_residency> residency; // one entry per loaded chunk
+  std::list<std::pair<int, int>> unused_chunks; // least recently used first
+  size_t chunk_memory_budget; // for the chunks of all shards together
+
+ public:
+  world_shard (caf::actor_config& cfg, int rx, int rz, const caf::actor& world_actor,
+      const caf::actor& script_eng, const caf::actor& world_gen, const caf::actor& chunk_encoder,
+      std::shared_ptr<world_provider> provider, size_t chunk_memory_budget);
+
+  caf::behavior make_behavior () override;
+  void on_exit () override;
+
+  //! \brief Checks whether the specified chunk belongs to the shard's region.
+  [[nodiscard]] inline bool owns_chunk (int cx, int cz) const
+  { return (cx >> world_region_shift) == this->rx && (cz >> world_region_shift) == this->rz; }
+
+  //! \brief Checks whether the specified chunk lies on the border of its region.
+  [[nodiscard]] static inline bool is_border_chunk (int cx, int cz)
+  {
+    constexpr int mask = (1 << world_region_shift) - 1;
+    return (cx & mask) == 0 || (cx & mask) == mask || (cz & mask) == 0 || (cz & mask) == mask;
+  }
+
+ private:
+  //! \brief Queues a lighting update, handing it to the world if it belongs to another region.
+  void queue_lighting_update (block_pos pos);
+
+  //! \brief Shares a newly loaded chunk with the neighbouring shards, and asks for the chunks next to it.
+  void exchange_border_chunks (const chunk& ch);
+
+  //! \brief Sends snapshots of border chunks that changed since they were last shared to the neighbouring shards.
+  void share_border_chunks ();
+
+  //! \brief Has the world generator make the specified chunk, and sends it to the players waiting for it.
+  void generate_chunk (int cx, int cz);
+
+  //! \brief Sends a chunk to a player, loading or generating it first if necessary.
+  void request_chunk (int cx, int cz, const caf::actor& broker);
+
+  //! \brief Processes queued sky/block lighting updates
+  void handle_lighting (int max_updates=max_lighting_updates);
+
+  //! \brief Sends block changes made during the last tick to players.
+  void flush_block_changes ();
+
+  //! \brief Sends light of sections that changed during the last tick to players.
+  void flush_light_changes ();
+
+  //! \brief Has a snapshot of the chunk encoded and sent (along with its light) to a player.
+  void encode_chunk (const chunk& ch, const caf::actor& broker);
+
+  //! \brief Called once a chunk has been sent to a player by the chunk encoder.
+  void chunk_encoded (int cx, int cz, uint64_t version, const caf::actor& broker);
+
+  //! \brief Sends block changes made to a chunk during the last tick to its subscribers.
+  void send_block_changes (chunk& ch, const std::map<unsigned short, unsigned short>& changes,
+                           const int counts[16]);
+
+  //! \brief Delegates changes made to the world to the world's provider.
+  void save ();
+
+  chunk* find_chunk (int cx, int cz);
+
+  //! \brief Like find_chunk, but also finds snapshots of chunks just across the region's border (which must not be modified).
+  chunk* find_readable_chunk (int cx, int cz);
+
+  //! \brief Attempts to load a chunk at the specified coordinates.
+  chunk* load_chunk (int cx, int cz);
+
+  //! \brief Stores a chunk that was loaded or generated, unless there already is one at its coordinates.
+  chunk* add_chunk (int cx, int cz, std::unique_ptr<chunk> ch);
+
+  //! \brief Checks whether players, scripts or the spawn area keep the specified chunk loaded.
+  bool is_chunk_in_use (int cx, int cz);
+
+  //! \brief Moves a loaded chunk into or out of the unused list after its users changed.
+  void update_chunk_usage (int cx, int cz);
+
+  //! \brief Marks an unused chunk as the most recently used one.
+  void touch_chunk (int cx, int cz);
+
+  //! \brief Updates the memory usage recorded for a loaded chunk.
+  void update_chunk_memory (const chunk& ch);
+
+  //! \brief Unloads unused chunks until chunks fit in the memory budget again.
+  void unload_unused_chunks ();
+
+  //! \brief Saves the specified chunk if necessary and removes it from memory.
+  void evict_chunk (int cx, int cz);
+
+  //! \brief Registers a player as having the specified chunk loaded.
+  void subscribe_chunk (int cx, int cz, const caf::actor_addr& cl, const caf::actor& broker);
+
+  //! \brief Removes a player from the subscriber list of the specified chunk.
+  void unsubscribe_chunk (int cx, int cz, const caf::actor_addr& cl);
+
+  //! \brief Removes a player from the subscriber lists of all chunks.
+  void unsubscribe_all (const caf::actor_addr& cl);
+
+  //! \brief Checks whether the player using the specified broker has the specified chunk loaded.
+  bool is_subscribed (int cx, int cz, const caf::actor& broker);
+
+  //! \brief Sends a packet to every player that has the specified chunk loaded.
+  void send_to_subscribers (int cx, int cz, const packet_buffer& buf);
+
+  void set_block_id (int x, int y, int z, unsigned short id);
+  unsigned short get_block_id (int x, int y, int z);
+
+  void set_sky_light (int x, int y, int z, unsigned char val);
+  unsigned char get_sky_light (int x, int y, int z);
+};
+
+#endif //NOSTALGIA_WORLD_SHARD_HPP
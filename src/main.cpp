@@ -17,141 +17,66 @@
  */
 
 #include <iostream>
-#include <vector>
 
 #include "caf/all.hpp"
 #include "caf/io/all.hpp"
 
-#include "player/client.hpp"
 #include "system/server.hpp"
 #include "scripting/scripting.hpp"
-#include "network/packet_writer.hpp"
+#include "network/broker.hpp"
+#include "network/compression.hpp"
 #include "system/console.hpp"
+#include "system/consts.hpp"
 
 
 class nostalgia_config : public caf::actor_system_config
 {
  public:
+  caf::timespan flush_interval = std::chrono::milliseconds (default_flush_interval_ms);
+  size_t flush_threshold = default_flush_threshold;
+  int compression_threshold = default_compression_threshold;
+  size_t compression_workers = default_compression_workers;
+  size_t chunk_encoder_workers = default_chunk_encoder_workers;
+  size_t world_generator_workers = default_world_generator_workers;
+  size_t outbound_byte_budget = default_outbound_byte_budget;
+  size_t outbound_packet_budget = default_outbound_packet_budget;
+  caf::timespan overload_timeout = std::chrono::milliseconds (default_overload_timeout_ms);
+  size_t chunk_memory_budget = default_chunk_memory_budget;
+
+  nostalgia_config ()
+  {
+    caf::opt_group { custom_options_, "nostalgia" }
+      .add (this->flush_interval, "flush-interval", "max delay before queued packets are sent")
+      .add (this->flush_threshold, "flush-threshold", "queued bytes that force an immediate send")
+      .add (this->compression_threshold, "compression-threshold", "min packet size to compress (-1 to disable)")
+      .add (this->compression_workers, "compression-workers", "number of packet compression actors")
+      .add (this->chunk_encoder_workers, "chunk-encoder-workers", "number of chunk packet encoding actors")
+      .add (this->world_generator_workers, "world-generator-workers", "number of chunk generation actors")
+      .add (this->outbound_byte_budget, "outbound-byte-budget", "unsent bytes per client before world updates are held back")
+      .add (this->outbound_packet_budget, "outbound-packet-budget", "max held back packets per client")
+      .add (this->overload_timeout, "overload-timeout", "time a client may stay over its byte budget")
+      .add (this->chunk_memory_budget, "chunk-memory-budget", "bytes of loaded chunks before unused ones are unloaded");
+  }
 };
 
 
 
-struct client_broker_state
-{
-  caf::actor srv;
-  caf::actor cl;
-  unsigned int client_id;
-
-  unsigned int packet_size = 0;
-  unsigned int num_size_bytes_received = 0;
-  bool waiting_for_packet_data = false;
-};
-
-caf::behavior
-client_broker_impl (caf::io::broker *self, caf::io::connection_handle hdl,
-                    client_broker_state* state)
-{
-  self->configure_read (hdl, caf::io::receive_policy::exactly (1));
-
-  // announce self to client and link together
-  self->send (state->cl, broker_atom::value, caf::actor_cast<caf::actor> (self));
-  self->link_to (state->cl);
-
-  self->set_exit_handler ([=] (caf::exit_msg& msg) {
-    caf::aout (self) << "Client actor stopped." << std::endl;
-    self->send (self, caf::io::connection_closed_msg { hdl });
-  });
-
-  return {
-    [=] (const caf::io::connection_closed_msg& msg) {
-      caf::aout (self) << "Connection closed." << std::endl;
-      self->close (hdl);
-
-      // remove client from server
-      self->send (state->srv, del_client_atom::value, state->client_id);
-
-      self->quit (caf::exit_reason::user_shutdown);
-    },
-
-    [=] (const caf::io::new_data_msg& msg) {
-      if (state->waiting_for_packet_data)
-        {
-          // relay packet contents to associated client actor.
-          self->send (state->cl, packet_in_atom::value, msg.buf);
-
-          // reset state for next packet
-          self->configure_read (hdl, caf::io::receive_policy::exactly (1));
-          state->waiting_for_packet_data = false;
-          state->num_size_bytes_received = 0;
-          state->packet_size = 0;
-        }
-      else
-        {
-          unsigned int byte = msg.buf[0];
-          state->packet_size |= (byte & 0x7F) << (7 * state->num_size_bytes_received);
-          ++ state->num_size_bytes_received;
-          if (!(byte & 0x80))
-            {
-              // this was the last byte belonging to packet length field.
-              state->waiting_for_packet_data = true;
-              self->configure_read (hdl, caf::io::receive_policy::exactly (state->packet_size));
-            }
-        }
-    },
-
-    //
-    // Handles packet send requests from associated client actor.
-    //
-    [=] (packet_out_atom, const std::vector<char>& buf) {
-      // write the size of the packet
-      packet_writer writer;
-      writer.write_varlong (buf.size ());
-      self->write (hdl, writer.position (), writer.data ());
-
-      self->write (hdl, buf.size (), buf.data ());
-      self->flush (hdl);
-    }
-  };
-}
-
-
-
-struct server_broker_state
-{
-  std::vector<std::unique_ptr<client_broker_state>> states;
-  unsigned int next_client_id = 1;
-};
-
-caf::behavior
-server_broker_impl (caf::io::broker *self, server_broker_state *state,
-                    const caf::actor& srv, const caf::actor& script_eng)
-{
-  return {
-    [=] (const caf::io::new_connection_msg& msg) {
-      caf::aout (self) << "Accepted new connection!" << std::endl;
-      auto client_id = state->next_client_id++;
-      auto cl = self->system ().spawn<client_actor> (srv, script_eng, client_id);
-
-      state->states.emplace_back (new client_broker_state ());
-      auto client_broker_state = state->states.back ().get ();
-      client_broker_state->srv = srv;
-      client_broker_state->cl = cl;
-      client_broker_state->client_id = client_id;
-
-      auto client_broker = self->fork (client_broker_impl, msg.handle,
-          state->states.back ().get ());
-
-      self->send (srv, add_client_atom::value, cl, client_id);
-    }
-  };
-}
-
-
 void
 caf_main (caf::actor_system& system, const nostalgia_config& cfg)
 {
+  // an empty pool would silently drop every request sent to it
+  if (cfg.chunk_encoder_workers == 0 || cfg.world_generator_workers == 0)
+    {
+      std::cout << "chunk-encoder-workers and world-generator-workers must be at least 1" << std::endl;
+      return;
+    }
+
   auto script_eng = system.spawn<scripting_actor> ();
-  auto srv = system.spawn<server_actor> (script_eng);
+  server_settings srv_settings;
+  srv_settings.chunk_encoder_workers = cfg.chunk_encoder_workers;
+  srv_settings.world_generator_workers = cfg.world_generator_workers;
+  srv_settings.chunk_memory_budget = cfg.chunk_memory_budget;
+  auto srv = system.spawn<server_actor> (script_eng, srv_settings);
 
   // initialize server
   {
@@ -167,6 +92,15 @@ caf_main (caf::actor_system& system, const nostalgia_config& cfg)
   }
 
   auto broker_state = new server_broker_state ();
+  broker_state->settings.flush_interval = cfg.flush_interval;
+  broker_state->settings.flush_threshold = cfg.flush_threshold;
+  broker_state->settings.compression_threshold = cfg.compression_threshold;
+  broker_state->settings.outbound_byte_budget = cfg.outbound_byte_budget;
+  broker_state->settings.outbound_packet_budget = cfg.outbound_packet_budget;
+  broker_state->settings.overload_timeout = cfg.overload_timeout;
+  broker_state->settings.compressor = caf::actor_pool::make (
+      system.dummy_execution_unit (), cfg.compression_workers,
+      [&] { return system.spawn (compressor_impl); }, caf::actor_pool::round_robin ());
   auto server_broker_actor = system.middleman ().spawn_server (server_broker_impl, 25565, broker_state, srv, script_eng);
   if (!server_broker_actor)
     {
@@ -0,0 +1,578 @@
+/*
+ * Nostalgia - A custom Minecraft server.
+ * Copyright (C) 2019  Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "network/broker.hpp"
+#include "network/packet_reader.hpp"
+#include "network/packet_writer.hpp"
+#include "network/packets.hpp"
+#include "network/compression.hpp"
+#include "network/packet_buffer.hpp"
+#include "player/client.hpp"
+#include "system/atoms.hpp"
+#include "system/consts.hpp"
+#include "system/metrics.hpp"
+#include <cstring>
+
+
+void
+inbound_buffer::append (const char *data, size_t len)
+{
+  if (this->tail + len > this->buf.size ())
+    {
+      // reclaim space taken by frames that were already consumed
+      auto remaining = this->tail - this->head;
+      if (this->head > 0)
+        {
+          std::memmove (this->buf.data (), this->buf.data () + this->head, remaining);
+          this->head = 0;
+          this->tail = remaining;
+        }
+
+      if (this->tail + len > this->buf.size ())
+        this->buf.resize (this->tail + len);
+    }
+
+  std::memcpy (this->buf.data () + this->tail, data, len);
+  this->tail += len;
+}
+
+bool
+inbound_buffer::next_frame (std::vector<char>& frame)
+{
+  auto data = reinterpret_cast<const unsigned char *> (this->buf.data () + this->head);
+  auto avail = this->tail - this->head;
+
+  // decode length prefix
+  size_t frame_size = 0;
+  size_t prefix_size = 0;
+  for (;;)
+    {
+      if (prefix_size == avail)
+        return false; // length prefix not received in full yet
+      if (prefix_size == max_packet_size_bytes)
+        throw bad_data_error ((unsigned)avail, (unsigned)prefix_size);
+
+      auto byte = data[prefix_size];
+      frame_size |= (size_t)(byte & 0x7F) << (7 * prefix_size);
+      ++ prefix_size;
+      if (!(byte & 0x80))
+        break;
+    }
+
+  if (frame_size > max_packet_size)
+    throw bad_data_error ((unsigned)avail, (unsigned)prefix_size);
+  if (avail - prefix_size < frame_size)
+    return false; // frame body not received in full yet
+
+  auto body = this->buf.data () + this->head + prefix_size;
+  frame.assign (body, body + frame_size);
+
+  this->head += prefix_size + frame_size;
+  if (this->head == this->tail)
+    this->head = this->tail = 0;
+
+  return true;
+}
+
+
+
+static metrics::counter& _packets_out = metrics::get_counter ("broker.packets_out");
+static metrics::counter& _bytes_out = metrics::get_counter ("broker.bytes_out");
+static metrics::counter& _flushes = metrics::get_counter ("broker.flushes");
+static metrics::counter& _compressed_packets = metrics::get_counter ("broker.compressed_packets");
+static metrics::counter& _merged_block_changes = metrics::get_counter ("broker.merged_block_changes");
+static metrics::counter& _slow_disconnects = metrics::get_counter ("broker.slow_disconnects");
+static metrics::gauge& _unsent_bytes = metrics::get_gauge ("broker.unsent_bytes");
+static metrics::gauge& _deferred_packets = metrics::get_gauge ("broker.deferred_packets");
+
+//! \brief Returns the number of bytes handed to the broker that were not sent yet.
+static size_t
+_backlog (client_broker_state *state)
+{
+  return state->in_flight + state->queued_bytes;
+}
+
+static void
+_set_in_flight (client_broker_state *state, size_t bytes)
+{
+  _unsent_bytes.add ((int64_t)bytes - (int64_t)state->in_flight);
+  state->in_flight = bytes;
+}
+
+//! \brief Drops a client that cannot keep up with the data sent to it.
+static void
+_disconnect_slow (caf::io::broker *self, caf::io::connection_handle hdl,
+                  client_broker_state *state)
+{
+  if (state->disconnecting)
+    return;
+  state->disconnecting = true;
+
+  caf::aout (self) << "WARNING: Client " << state->client_id << " cannot keep up, disconnecting" << std::endl;
+  _slow_disconnects.add ();
+  self->send (self, caf::io::connection_closed_msg { hdl });
+}
+
+//! \brief Keeps track of how long the client has been over its byte budget.
+static void
+_update_overload (caf::io::broker *self, client_broker_state *state)
+{
+  bool over = _backlog (state) > state->settings.outbound_byte_budget;
+  if (over && !state->overloaded)
+    {
+      state->overloaded = true;
+      state->overloaded_since = std::chrono::steady_clock::now ();
+      self->delayed_send (self, state->settings.overload_timeout, check_overload_atom::value);
+    }
+  else if (!over)
+    state->overloaded = false;
+}
+
+//! \brief Pushes all packets queued since the last flush out to the socket.
+static void
+_flush_queued (caf::io::broker *self, caf::io::connection_handle hdl,
+               client_broker_state *state)
+{
+  if (state->queued_packets == 0)
+    return;
+
+  self->flush (hdl);
+  _set_in_flight (state, state->in_flight + state->queued_bytes);
+
+  _packets_out.add (state->queued_packets);
+  _bytes_out.add (state->queued_bytes);
+  _flushes.add ();
+  state->total_packets += state->queued_packets;
+  ++ state->total_flushes;
+
+  state->queued_packets = 0;
+  state->queued_bytes = 0;
+
+  _update_overload (self, state);
+}
+
+//! \brief Accounts for a frame written to the write buffer and schedules a flush.
+static void
+_frame_written (caf::io::broker *self, caf::io::connection_handle hdl,
+                client_broker_state *state, size_t size)
+{
+  state->queued_bytes += size;
+  ++ state->queued_packets;
+
+  if (state->queued_bytes >= state->settings.flush_threshold)
+    _flush_queued (self, hdl, state);
+  else if (!state->flush_scheduled)
+    {
+      state->flush_scheduled = true;
+      self->delayed_send (self, state->settings.flush_interval, flush_atom::value);
+    }
+}
+
+//! \brief Appends a finished frame to the connection's write buffer and schedules a flush.
+static void
+_write_frame (caf::io::broker *self, caf::io::connection_handle hdl,
+              client_broker_state *state, std::vector<char>& frame)
+{
+  auto size = frame.size ();
+
+  // hand the frame over to the connection's write buffer, avoiding
+  // a copy when nothing else is waiting to be written.
+  auto& out = self->wr_buf (hdl);
+  if (out.empty ())
+    out.swap (frame);
+  else
+    out.insert (out.end (), frame.begin (), frame.end ());
+
+  _frame_written (self, hdl, state, size);
+}
+
+//! \brief Writes out frames at the head of the pending queue that are ready to be sent.
+static void
+_drain_pending (caf::io::broker *self, caf::io::connection_handle hdl,
+                client_broker_state *state)
+{
+  auto& pending = state->pending;
+  while (!pending.empty () && pending.front ().ready)
+    {
+      _write_frame (self, hdl, state, pending.front ().data);
+      pending.pop_front ();
+      ++ state->pending_base;
+    }
+}
+
+/*!
+ * \brief Has the compressor pool compress a packet, and queues it for
+ *        sending in the meantime.
+ *
+ * Since replies may arrive in any order, any packet sent while an earlier
+ * one is still being compressed waits in the pending queue. Packets that
+ * fail to compress are sent uncompressed instead.
+ */
+static void
+_compress_packet (caf::io::broker *self, caf::io::connection_handle hdl,
+                  client_broker_state *state, const packet_buffer& buf)
+{
+  auto seq = state->pending_base + state->pending.size ();
+  state->pending.emplace_back ();
+  _compressed_packets.add ();
+  self->request (state->settings.compressor, caf::infinite, compress_atom::value, buf).then (
+      [=] (const packet_buffer& res) {
+        auto& entry = state->pending[seq - state->pending_base];
+        entry.data = res.compressed_frame ();
+        entry.ready = true;
+        _drain_pending (self, hdl, state);
+      },
+      [=] (caf::error&) {
+        auto& entry = state->pending[seq - state->pending_base];
+        entry.data = buf.frame ();
+        make_uncompressed_frame (entry.data);
+        entry.ready = true;
+        _drain_pending (self, hdl, state);
+      });
+}
+
+/*!
+ * \brief Frames a packet produced by packet_writer according to the
+ *        connection's compression settings and queues it for sending.
+ *
+ * Packets above the compression threshold are handed to the compressor
+ * pool (see _compress_packet).
+ */
+static void
+_send_packet (caf::io::broker *self, caf::io::connection_handle hdl,
+              client_broker_state *state, std::vector<char>& frame)
+{
+  auto threshold = state->compression_threshold;
+  auto payload_size = frame.size () - packet_header_size;
+  if (threshold >= 0 && payload_size >= (size_t)threshold)
+    {
+      _compress_packet (self, hdl, state, packet_buffer (std::move (frame)));
+      return;
+    }
+
+  if (threshold >= 0)
+    make_uncompressed_frame (frame);
+  else
+    write_frame_header (frame);
+
+  if (state->pending.empty ())
+    _write_frame (self, hdl, state, frame);
+  else
+    state->pending.push_back ({ std::move (frame), true });
+}
+
+
+/*!
+ * \brief Queues a packet shared with other brokers for sending.
+ *
+ * The shared frame is never modified: its header is written separately
+ * and its payload copied straight into the connection's write buffer.
+ */
+static void
+_send_shared_packet (caf::io::broker *self, caf::io::connection_handle hdl,
+                     client_broker_state *state, const packet_buffer& buf)
+{
+  auto threshold = state->compression_threshold;
+  auto payload_size = buf.payload_size ();
+  if (threshold >= 0 && payload_size >= (size_t)threshold)
+    {
+      _compress_packet (self, hdl, state, buf);
+      return;
+    }
+
+  char header[packet_header_size + 1];
+  size_t header_size = packet_header_size;
+  if (threshold >= 0)
+    {
+      write_padded_length (header, (unsigned)payload_size + 1);
+      header[header_size ++] = 0; // uncompressed data
+    }
+  else
+    write_padded_length (header, (unsigned)payload_size);
+
+  auto payload = buf.payload ();
+  if (state->pending.empty ())
+    {
+      auto& out = self->wr_buf (hdl);
+      out.insert (out.end (), header, header + header_size);
+      out.insert (out.end (), payload, payload + payload_size);
+      _frame_written (self, hdl, state, header_size + payload_size);
+    }
+  else
+    {
+      pending_frame entry { std::vector<char> (header, header + header_size), true };
+      entry.data.insert (entry.data.end (), payload, payload + payload_size);
+      state->pending.push_back (std::move (entry));
+    }
+}
+
+
+/*!
+ * \brief Checks whether a packet should be held back instead of being sent.
+ *
+ * Only world updates (chunk data, chunk unloads and block changes) are ever
+ * held back. Once one is held back, all following ones are as well so that
+ * they reach the client in order. Other packets (keep alives, chat, etc.)
+ * are always sent right away.
+ *
+ * NOTE: Packets are recognized by their ID alone. The IDs checked here are
+ *       not used by any clientbound login or status packet.
+ */
+static bool
+_should_defer (client_broker_state *state, const char *payload, size_t size)
+{
+  if (size == 0)
+    return false;
+
+  switch ((unsigned char)payload[0])
+    {
+    case OPI_BLOCK_CHANGE:
+    case OPI_MULTI_BLOCK_CHANGE:
+    case OPI_UNLOAD_CHUNK:
+    case OPI_CHUNK_DATA:
+      break;
+
+    default:
+      return false;
+    }
+
+  return !state->deferred.empty () || _backlog (state) > state->settings.outbound_byte_budget;
+}
+
+/*!
+ * \brief Holds back a world update until the client catches up.
+ *
+ * A held back BLOCK CHANGE replaces any earlier one for the same position.
+ */
+static void
+_defer_packet (caf::io::broker *self, caf::io::connection_handle hdl,
+               client_broker_state *state, packet_buffer buf)
+{
+  auto seq = state->deferred_base + state->deferred.size ();
+  deferred_packet entry { std::move (buf) };
+
+  if (entry.buf.payload ()[0] == OPI_BLOCK_CHANGE && entry.buf.payload_size () >= 9)
+    {
+      entry.keyed = true;
+      std::memcpy (&entry.key, entry.buf.payload () + 1, 8);
+
+      auto itr = state->deferred_block_changes.find (entry.key);
+      if (itr != state->deferred_block_changes.end ())
+        {
+          state->deferred[itr->second - state->deferred_base].dropped = true;
+          -- state->deferred_live;
+          _deferred_packets.sub (1);
+          _merged_block_changes.add ();
+          itr->second = seq;
+        }
+      else
+        state->deferred_block_changes[entry.key] = seq;
+    }
+
+  state->deferred.push_back (std::move (entry));
+  ++ state->deferred_live;
+  _deferred_packets.add (1);
+
+  if (state->deferred_live > state->settings.outbound_packet_budget)
+    _disconnect_slow (self, hdl, state);
+}
+
+//! \brief Sends held back packets for as long as the client stays within its byte budget.
+static void
+_release_deferred (caf::io::broker *self, caf::io::connection_handle hdl,
+                   client_broker_state *state)
+{
+  auto& deferred = state->deferred;
+  while (!deferred.empty () && _backlog (state) <= state->settings.outbound_byte_budget)
+    {
+      auto& entry = deferred.front ();
+      if (!entry.dropped)
+        {
+          if (entry.keyed)
+            state->deferred_block_changes.erase (entry.key);
+
+          -- state->deferred_live;
+          _deferred_packets.sub (1);
+          _send_shared_packet (self, hdl, state, entry.buf);
+        }
+
+      deferred.pop_front ();
+      ++ state->deferred_base;
+    }
+}
+
+
+caf::behavior
+client_broker_impl (caf::io::broker *self, caf::io::connection_handle hdl,
+                    client_broker_state *state)
+{
+  self->configure_read (hdl, caf::io::receive_policy::at_most (inbound_read_size));
+  self->ack_writes (hdl, true);
+
+  // announce self to client and link together
+  self->send (state->cl, broker_atom::value, caf::actor_cast<caf::actor> (self));
+  self->link_to (state->cl);
+
+  self->set_exit_handler ([=] (caf::exit_msg& msg) {
+    caf::aout (self) << "Client actor stopped." << std::endl;
+    state->closing = true;
+    self->send (self, caf::io::connection_closed_msg { hdl });
+  });
+
+  return {
+    [=] (const caf::io::connection_closed_msg& msg) {
+      caf::aout (self) << "Connection closed (sent " << state->total_packets << " packets in "
+                       << state->total_flushes << " flushes)." << std::endl;
+
+      // packets sent right before closing (e.g. a disconnect message)
+      // must not wait for the flush timer, unless the peer is gone.
+      if (state->closing)
+        {
+          _drain_pending (self, hdl, state);
+          _flush_queued (self, hdl, state);
+        }
+      self->close (hdl);
+
+      _set_in_flight (state, 0);
+      _deferred_packets.sub ((int64_t)state->deferred_live);
+      state->deferred_live = 0;
+      state->deferred.clear ();
+
+      // remove client from server
+      self->send (state->srv, del_client_atom::value, state->client_id);
+
+      self->quit (caf::exit_reason::user_shutdown);
+    },
+
+    [=] (const caf::io::new_data_msg& msg) {
+      state->inbound.append (msg.buf.data (), msg.buf.size ());
+
+      // relay every complete packet to the associated client actor.
+      try
+        {
+          std::vector<char> frame;
+          while (state->inbound.next_frame (frame))
+            {
+              if (state->compression_threshold >= 0)
+                {
+                  std::vector<char> packet;
+                  read_compressed_frame (frame, packet);
+                  self->send (state->cl, packet_in_atom::value, std::move (packet));
+                }
+              else
+                self->send (state->cl, packet_in_atom::value, std::move (frame));
+            }
+        }
+      catch (const bad_data_error&)
+        {
+          caf::aout (self) << "WARNING: Got malformed packet frame" << std::endl;
+          state->closing = true;
+          self->send (self, caf::io::connection_closed_msg { hdl });
+        }
+    },
+
+    //
+    // Handles packet send requests from associated client actor.
+    // Packets are coalesced in the write buffer and flushed once per flush
+    // interval, or earlier if enough bytes pile up.
+    //
+    [=] (packet_out_atom, std::vector<char>& frame) {
+      if (_should_defer (state, frame.data () + packet_header_size, frame.size () - packet_header_size))
+        _defer_packet (self, hdl, state, packet_buffer (std::move (frame)));
+      else
+        _send_packet (self, hdl, state, frame);
+    },
+
+    [=] (packet_out_atom, const packet_buffer& buf) {
+      if (_should_defer (state, buf.payload (), buf.payload_size ()))
+        _defer_packet (self, hdl, state, buf);
+      else
+        _send_shared_packet (self, hdl, state, buf);
+    },
+
+    //
+    // Sent by the connection every time data is written to the socket.
+    // Held back packets are sent as soon as the client catches up.
+    //
+    [=] (const caf::io::data_transferred_msg& msg) {
+      // the remaining count includes data that was not flushed yet
+      auto unsent = msg.remaining > state->queued_bytes ? msg.remaining - state->queued_bytes : 0;
+      _set_in_flight (state, (size_t)unsent);
+
+      _release_deferred (self, hdl, state);
+      _update_overload (self, state);
+    },
+
+    [=] (check_overload_atom) {
+      if (!state->overloaded)
+        return;
+
+      auto elapsed = std::chrono::steady_clock::now () - state->overloaded_since;
+      if (elapsed >= state->settings.overload_timeout)
+        _disconnect_slow (self, hdl, state);
+      else
+        self->delayed_send (self, state->settings.overload_timeout - elapsed, check_overload_atom::value);
+    },
+
+    //
+    // Sent by the client actor during login. Announces the compression
+    // threshold to the client (if compression is enabled at all) and
+    // switches the connection over to the compressed packet format.
+    //
+    [=] (enable_compression_atom) {
+      auto threshold = state->settings.compression_threshold;
+      if (threshold < 0 || state->compression_threshold >= 0)
+        return;
+
+      auto frame = packets::login::make_set_compression (threshold).move_data ();
+      _send_packet (self, hdl, state, frame);
+      state->compression_threshold = threshold;
+    },
+
+    [=] (flush_atom) {
+      state->flush_scheduled = false;
+      _flush_queued (self, hdl, state);
+    }
+  };
+}
+
+
+caf::behavior
+server_broker_impl (caf::io::broker *self, server_broker_state *state,
+                    const caf::actor& srv, const caf::actor& script_eng)
+{
+  return {
+    [=] (const caf::io::new_connection_msg& msg) {
+      caf::aout (self) << "Accepted new connection!" << std::endl;
+      auto client_id = state->next_client_id++;
+      auto cl = self->system ().spawn<client_actor> (srv, script_eng, client_id);
+
+      state->states.emplace_back (new client_broker_state ());
+      auto client_broker_state = state->states.back ().get ();
+      client_broker_state->srv = srv;
+      client_broker_state->cl = cl;
+      client_broker_state->client_id = client_id;
+      client_broker_state->settings = state->settings;
+
+      auto client_broker = self->fork (client_broker_impl, msg.handle,
+          state->states.back ().get ());
+
+      self->send (srv, add_client_atom::value, cl, client_id);
+    }
+  };
+}
@@ -0,0 +1,106 @@
+/*
+ * Nostalgia - A custom Minecraft server.
+ * Copyright (C) 2019  Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "network/compression.hpp"
+#include "network/packet_reader.hpp"
+#include "network/packet_writer.hpp"
+#include "network/packet_buffer.hpp"
+#include "system/atoms.hpp"
+#include "system/consts.hpp"
+#include <zlib.h>
+#include <stdexcept>
+#include <cstring>
+
+
+void
+make_uncompressed_frame (std::vector<char>& frame)
+{
+  // make room for the data length field
+  frame.insert (frame.begin () + packet_header_size, 0);
+  write_padded_length (frame.data (), (unsigned)(frame.size () - packet_header_size));
+}
+
+std::vector<char>
+make_compressed_frame (const std::vector<char>& frame)
+{
+  auto payload = reinterpret_cast<const Bytef *> (frame.data () + packet_header_size);
+  auto payload_size = (unsigned int)(frame.size () - packet_header_size);
+
+  auto data_len_size = varlong_size (payload_size);
+  auto header_size = packet_header_size + data_len_size;
+  auto bound = compressBound (payload_size);
+
+  std::vector<char> out (header_size + bound);
+  auto dest_len = (uLongf)bound;
+  auto res = compress2 (reinterpret_cast<Bytef *> (out.data () + header_size), &dest_len,
+                        payload, payload_size, Z_DEFAULT_COMPRESSION);
+  if (res != Z_OK)
+    throw std::runtime_error ("zlib: failed to compress packet");
+
+  out.resize (header_size + dest_len);
+  write_padded_length (out.data (), (unsigned)(data_len_size + dest_len));
+  encode_varlong (payload_size, out.data () + packet_header_size);
+  return out;
+}
+
+void
+read_compressed_frame (const std::vector<char>& frame, std::vector<char>& out)
+{
+  packet_reader reader (frame);
+  auto data_len = reader.read_varlong ();
+  auto rest = frame.data () + reader.position ();
+  auto rest_size = frame.size () - reader.position ();
+
+  if (data_len == 0)
+    {
+      // packet was below the compression threshold
+      out.assign (rest, rest + rest_size);
+      return;
+    }
+
+  if (data_len < 0 || data_len > (int64_t)max_packet_size)
+    throw bad_data_error (reader.size (), reader.position ());
+
+  out.resize ((size_t)data_len);
+  auto dest_len = (uLongf)data_len;
+  auto res = uncompress (reinterpret_cast<Bytef *> (out.data ()), &dest_len,
+                         reinterpret_cast<const Bytef *> (rest), (uLong)rest_size);
+  if (res != Z_OK || dest_len != (uLongf)data_len)
+    throw bad_data_error (reader.size (), reader.position ());
+}
+
+
+caf::behavior
+compressor_impl (caf::event_based_actor *self)
+{
+  return {
+    // frames cache their compressed form, so it is only computed once.
+    // failures are reported to the broker, which sends the frame uncompressed.
+    [=] (compress_atom, const packet_buffer& buf) -> caf::result<packet_buffer> {
+      try
+        {
+          buf.compressed_frame ();
+        }
+      catch (const std::exception&)
+        {
+          return caf::make_error (caf::sec::runtime_error);
+        }
+      return buf;
+    }
+  };
+}
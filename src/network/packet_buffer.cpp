@@ -0,0 +1,58 @@
+/*
+ * Nostalgia - A custom Minecraft server.
+ * Copyright (C) 2019  Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "network/packet_buffer.hpp"
+#include "network/packet_writer.hpp"
+#include "network/compression.hpp"
+
+
+packet_buffer::packet_buffer (std::vector<char>&& frame)
+  : ptr (std::make_shared<shared_frame> ())
+{
+  this->ptr->frame = std::move (frame);
+}
+
+packet_buffer::packet_buffer (packet_writer&& writer)
+  : packet_buffer (writer.move_data ())
+{
+  // nop
+}
+
+
+size_t
+packet_buffer::payload_size () const
+{
+  return this->ptr->frame.size () - packet_header_size;
+}
+
+const char*
+packet_buffer::payload () const
+{
+  return this->ptr->frame.data () + packet_header_size;
+}
+
+const std::vector<char>&
+packet_buffer::compressed_frame () const
+{
+  auto& sf = *this->ptr;
+  std::call_once (sf.compress_flag, [&sf] {
+    sf.compressed = make_compressed_frame (sf.frame);
+  });
+
+  return sf.compressed;
+}
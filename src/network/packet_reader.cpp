@@ -17,6 +17,12 @@
  */
 
 #include "network/packet_reader.hpp"
+#include "util/bits.hpp"
+#include <cstring>
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
 
 #define MAX_STRING_SIZE 32767
 #define THROW_BAD_DATA \
@@ -50,8 +56,9 @@ packet_reader::read_short ()
 {
   if (this->pos + 2 > this->buf.size ())
     THROW_BAD_DATA;
+  auto val = load_be16 (this->data + this->pos);
   this->pos += 2;
-  return ((int16_t)this->data[this->pos - 2] << 8) | (int16_t)this->data[this->pos - 1];
+  return (int16_t)val;
 }
 
 int32_t
@@ -59,11 +66,9 @@ packet_reader::read_int ()
 {
   if (this->pos + 4 > this->buf.size ())
     THROW_BAD_DATA;
+  auto val = load_be32 (this->data + this->pos);
   this->pos += 4;
-  return ((int32_t)this->data[this->pos - 4] << 24)
-         | ((int32_t)this->data[this->pos - 3] << 16)
-         | ((int32_t)this->data[this->pos - 2] << 8)
-         | (int32_t)this->data[this->pos - 1];
+  return (int32_t)val;
 }
 
 int64_t
@@ -71,58 +76,123 @@ packet_reader::read_long ()
 {
   if (this->pos + 8 > this->buf.size ())
     THROW_BAD_DATA;
+  auto val = load_be64 (this->data + this->pos);
   this->pos += 8;
-  return ((uint64_t)this->data[this->pos - 8] << 56)
-         | ((uint64_t)this->data[this->pos - 7] << 48)
-         | ((uint64_t)this->data[this->pos - 6] << 40)
-         | ((uint64_t)this->data[this->pos - 5] << 32)
-         | ((uint64_t)this->data[this->pos - 4] << 24)
-         | ((uint64_t)this->data[this->pos - 3] << 16)
-         | ((uint64_t)this->data[this->pos - 2] << 8)
-         | (uint64_t)this->data[this->pos - 1];
+  return (int64_t)val;
 }
 
+//! \brief Collects the low 7 bits of each byte in a little-endian word.
+static inline uint64_t
+_gather_varlong_bits (uint64_t word)
+{
+#ifdef __BMI2__
+  return _pext_u64 (word, 0x7F7F7F7F7F7F7F7FULL);
+#else
+  return (word & 0x7FULL)
+         | ((word & 0x7F00ULL) >> 1)
+         | ((word & 0x7F0000ULL) >> 2)
+         | ((word & 0x7F000000ULL) >> 3)
+         | ((word & 0x7F00000000ULL) >> 4)
+         | ((word & 0x7F0000000000ULL) >> 5)
+         | ((word & 0x7F000000000000ULL) >> 6)
+         | ((word & 0x7F00000000000000ULL) >> 7);
+#endif
+}
+
+/*!
+ * \brief Reads a variable-length integer.
+ *
+ * Values encoded in up to 5 bytes are treated as VarInts and sign extended
+ * from 32 bits, so that negative VarInts come out negative.
+ */
 int64_t
 packet_reader::read_varlong ()
 {
-  int64_t num = 0;
-  unsigned num_bytes = 0;
-  while (num_bytes < 10)
+  auto avail = this->buf.size () - this->pos;
+  auto p = this->data + this->pos;
+  if (avail == 0)
+    THROW_BAD_DATA;
+
+  // most varlongs are a single byte long
+  if (!(p[0] & 0x80))
+    {
+      ++ this->pos;
+      return p[0];
+    }
+
+  uint64_t num;
+  unsigned int len;
+  if (avail >= 8)
+    {
+      // find the terminating byte in a single 8 byte load
+      uint64_t word;
+      std::memcpy (&word, p, 8);
+      uint64_t ends = ~word & 0x8080808080808080ULL;
+      if (ends)
+        {
+          len = (lowest_bit64 (ends) >> 3) + 1;
+          if (len < 8)
+            word &= (1ULL << (len * 8)) - 1;
+          num = _gather_varlong_bits (word);
+          this->pos += len;
+          return (len <= 5) ? (int64_t)(int32_t)(uint32_t)num : (int64_t)num;
+        }
+    }
+
+  // long (9-10 byte) varlongs and varlongs at the end of the buffer
+  num = 0;
+  for (len = 0; len < 10; ++len)
     {
-      auto byte = this->read_byte ();
-      num |= ((byte & 0x7F) << (7 * num_bytes));
-      ++ num_bytes;
+      if (len == avail)
+        THROW_BAD_DATA;
+
+      uint64_t byte = p[len];
+      num |= (byte & 0x7F) << (7 * len);
       if (!(byte & 0x80))
-        return num; // done
+        {
+          this->pos += len + 1;
+          return (len < 5) ? (int64_t)(int32_t)(uint32_t)num : (int64_t)num;
+        }
     }
 
-  throw std::exception ("packet_reader: varlong longer than 10 bytes");
+  // varlong longer than 10 bytes
+  THROW_BAD_DATA;
 }
 
 float packet_reader::read_float ()
 {
   auto n = this->read_int ();
-  return *(float *)&n;
+  float val;
+  std::memcpy (&val, &n, 4);
+  return val;
 }
 
 double packet_reader::read_double ()
 {
   auto n = this->read_long ();
-  return *(double *)&n;
+  double val;
+  std::memcpy (&val, &n, 8);
+  return val;
 }
 
 std::string
 packet_reader::read_string (unsigned max_size)
+{
+  return std::string (this->read_string_view (max_size));
+}
+
+std::string_view
+packet_reader::read_string_view (unsigned max_size)
 {
   auto str_size = this->read_varlong ();
-  if (str_size > MAX_STRING_SIZE)
+  if (str_size < 0 || str_size > MAX_STRING_SIZE)
     THROW_BAD_DATA;
   if (max_size != 0 && str_size > max_size)
     THROW_BAD_DATA;
   if (this->pos + str_size > this->size ())
     THROW_BAD_DATA;
 
-  std::string str (this->buf.data () + this->pos, str_size);
+  std::string_view str (this->buf.data () + this->pos, (size_t)str_size);
   this->pos += (unsigned)str_size;
 
   return str;
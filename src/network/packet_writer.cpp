@@ -18,9 +18,33 @@
 
 #include "network/packet_writer.hpp"
 #include "util/nbt.hpp"
+#include "system/consts.hpp"
+#include "util/bits.hpp"
 #include <iomanip>
+#include <cstring>
 
 
+packet_writer::packet_writer ()
+  : buf (packet_header_size)
+{
+  // nop
+}
+
+
+//! \brief Grows the buffer so that len more bytes fit past the write position.
+void
+packet_writer::expand (unsigned int len)
+{
+  auto need = (size_t)this->pos + len;
+  auto size = this->buf.size () * 2;
+  if (size < need)
+    size = need;
+  if (size < 64)
+    size = 64;
+
+  this->buf.resize (size);
+}
+
 
 void
 packet_writer::write_bool (bool val)
@@ -31,74 +55,57 @@ packet_writer::write_bool (bool val)
 void
 packet_writer::write_byte (uint8_t val)
 {
-  if (this->pos == this->buf.size ())
-    {
-      this->buf.push_back (val);
-      ++ this->pos;
-    }
-  else
-    this->buf[this->pos ++] = val;
+  *this->ensure (1) = (char)val;
+  ++ this->pos;
 }
 
 void
 packet_writer::write_short (uint16_t val)
 {
-  this->write_byte ((uint8_t)(val >> 8));
-  this->write_byte ((uint8_t)(val & 0xFF));
+  store_be16 (this->ensure (2), val);
+  this->pos += 2;
 }
 
 void
 packet_writer::write_int (uint32_t val)
 {
-  this->write_byte ((uint8_t)(val >> 24));
-  this->write_byte ((uint8_t)((val >> 16) & 0xFF));
-  this->write_byte ((uint8_t)((val >> 8) & 0xFF));
-  this->write_byte ((uint8_t)(val & 0xFF));
+  store_be32 (this->ensure (4), val);
+  this->pos += 4;
 }
 
 void
 packet_writer::write_long (uint64_t val)
 {
-  this->write_byte ((uint8_t)(val >> 56));
-  this->write_byte ((uint8_t)((val >> 48) & 0xFF));
-  this->write_byte ((uint8_t)((val >> 40) & 0xFF));
-  this->write_byte ((uint8_t)((val >> 32) & 0xFF));
-  this->write_byte ((uint8_t)((val >> 24) & 0xFF));
-  this->write_byte ((uint8_t)((val >> 16) & 0xFF));
-  this->write_byte ((uint8_t)((val >> 8) & 0xFF));
-  this->write_byte ((uint8_t)(val & 0xFF));
+  store_be64 (this->ensure (8), val);
+  this->pos += 8;
 }
 
 void
 packet_writer::write_float (float val)
 {
-  this->write_int (*(uint32_t *)&val);
+  uint32_t n;
+  std::memcpy (&n, &val, 4);
+  this->write_int (n);
 }
 
 void
 packet_writer::write_double (double val)
 {
-  this->write_long (*(uint64_t *)&val);
+  uint64_t n;
+  std::memcpy (&n, &val, 8);
+  this->write_long (n);
 }
 
 void
 packet_writer::write_varlong (uint64_t val)
 {
-  while (val > 0x7F)
-    {
-      this->write_byte ((uint8_t)(0x80 | (val & 0x7F)));
-      val >>= 7;
-    }
-
-  this->write_byte ((uint8_t)val);
+  this->pos += encode_varlong (val, this->ensure (10));
 }
 
 void
 packet_writer::write_bytes (const void *data, unsigned int len)
 {
-  if (this->pos + len > this->buf.size ())
-    this->buf.resize (this->pos + len);
-  std::memcpy (this->buf.data () + this->pos, data, len);
+  std::memcpy (this->ensure (len), data, len);
   this->pos += len;
 }
 
@@ -134,14 +141,62 @@ packet_writer::write_nbt (const nbt_writer& writer)
 unsigned int
 varlong_size (uint64_t val)
 {
-  if (val < (1ULL << 7)) return 1;
-  if (val < (1ULL << 14)) return 2;
-  if (val < (1ULL << 21)) return 3;
-  if (val < (1ULL << 28)) return 4;
-  if (val < (1ULL << 35)) return 5;
-  if (val < (1ULL << 42)) return 6;
-  if (val < (1ULL << 49)) return 7;
-  if (val < (1ULL << 56)) return 8;
-  if (val < (1ULL << 63)) return 9;
-  return 10;
+  // every 7 bits of the value take up one byte
+  return (highest_bit64 (val | 1) * 9 + 73) / 64;
+}
+
+//! \brief Encodes a varlong into the specified buffer.
+unsigned int
+encode_varlong (uint64_t val, char *out)
+{
+  auto p = reinterpret_cast<unsigned char *> (out);
+
+  // fast paths for the most common sizes (packet IDs, lengths, block IDs)
+  if (val < (1ULL << 7))
+    {
+      p[0] = (unsigned char)val;
+      return 1;
+    }
+  if (val < (1ULL << 14))
+    {
+      p[0] = (unsigned char)(val | 0x80);
+      p[1] = (unsigned char)(val >> 7);
+      return 2;
+    }
+  if (val < (1ULL << 21))
+    {
+      p[0] = (unsigned char)(val | 0x80);
+      p[1] = (unsigned char)((val >> 7) | 0x80);
+      p[2] = (unsigned char)(val >> 14);
+      return 3;
+    }
+
+  unsigned int len = 0;
+  while (val > 0x7F)
+    {
+      p[len ++] = (unsigned char)(0x80 | (val & 0x7F));
+      val >>= 7;
+    }
+  p[len ++] = (unsigned char)val;
+
+  return len;
+}
+
+//! \brief Writes a frame length prefix padded to exactly packet_header_size bytes.
+void
+write_padded_length (char *out, unsigned int len)
+{
+  if (len > max_packet_size)
+    throw packet_too_large_error (len); // would not fit in the padded prefix
+
+  out[0] = (char)(0x80 | (len & 0x7F));
+  out[1] = (char)(0x80 | ((len >> 7) & 0x7F));
+  out[2] = (char)((len >> 14) & 0x7F);
+}
+
+//! \brief Fills in the length prefix of a frame produced by packet_writer.
+void
+write_frame_header (std::vector<char>& frame)
+{
+  write_padded_length (frame.data (), (unsigned int)(frame.size () - packet_header_size));
 }
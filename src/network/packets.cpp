@@ -57,6 +57,24 @@ namespace packets::play {
     return writer;
   }
 
+  packet_writer
+  make_multi_block_change (int cx, int cz, const std::vector<block_change_record>& records)
+  {
+    packet_writer writer;
+    writer.write_varlong (OPI_MULTI_BLOCK_CHANGE);
+    writer.write_int (cx);
+    writer.write_int (cz);
+    writer.write_varlong ((int)records.size ());
+    for (const auto& rec : records)
+      {
+        writer.write_byte (rec.xz);
+        writer.write_byte (rec.y);
+        writer.write_varlong (rec.id);
+      }
+
+    return writer;
+  }
+
   packet_writer
   make_chat_message_simple (const std::string& msg, char position)
   {
@@ -242,4 +260,13 @@ namespace packets::login {
     writer.write_string (username);
     return writer;
   }
+
+  packet_writer
+  make_set_compression (int threshold)
+  {
+    packet_writer writer;
+    writer.write_varlong (OPI_SET_COMPRESSION);
+    writer.write_varlong (threshold);
+    return writer;
+  }
 }
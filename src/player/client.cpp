@@ -22,6 +22,7 @@
 #include "network/packet_writer.hpp"
 #include "system/consts.hpp"
 #include "network/packets.hpp"
+#include "network/packet_buffer.hpp"
 #include "system/registries.hpp"
 #include "world/blocks.hpp"
 #include <chrono>
@@ -90,7 +91,11 @@ client_actor::make_behavior ()
           }
       },
 
-      [=] (packet_out_atom, const std::vector<char>& buf) {
+      [=] (packet_out_atom, std::vector<char>& buf) {
+        return this->delegate (this->broker, packet_out_atom::value, std::move (buf));
+      },
+
+      [=] (packet_out_atom, const packet_buffer& buf) {
         return this->delegate (this->broker, packet_out_atom::value, buf);
       },
 
@@ -300,7 +305,7 @@ client_actor::handle_handshake_packet (packet_reader& reader)
       throw disconnect ("wrong protocol version");
     }
 
-  reader.read_string (255);  // skip server address
+  reader.read_string_view (255);  // skip server address
   reader.read_unsigned_short ();  // skip server port
 
   auto next_state = reader.read_varlong ();
@@ -334,6 +339,9 @@ client_actor::handle_login_start_packet (packet_reader& reader)
         // inform scripting engine
         this->send (this->script_eng, register_player_atom::value, this->info);
 
+        // have the broker negotiate compression before login completes.
+        this->send (this->broker, enable_compression_atom::value);
+
         // transition into PLAY state.
         this->curr_state = connection_state::play;
         this->send_packet (packets::login::make_login_success (this->info.uuid, username));
@@ -366,7 +374,7 @@ client_actor::handle_chat_message_packet (packet_reader& reader)
 void
 client_actor::handle_client_settings_packet (packet_reader& reader)
 {
-  auto locale = reader.read_string (16);
+  auto locale = reader.read_string_view (16);
   int view_distance = reader.read_byte ();
   int chat_mode = (int)reader.read_varlong ();
   bool chat_colors = reader.read_bool ();
@@ -544,6 +552,9 @@ client_actor::join_world (const std::string& world_name)
         caf::aout (this) << "Got world information of \"" << info.name << "\" from server." << std::endl;
         this->curr_world = info;
 
+        // let the world send updates straight to our broker
+        this->send (this->curr_world.actor, join_world_atom::value, this, this->broker);
+
         this->pos = player_pos (0, 66.0, 0);
 
         // send initial chunks
@@ -633,6 +644,7 @@ client_actor::update_chunks ()
           // chunk outside chunk radius
           //caf::aout (this) << "Unloading chunk: " << x << "," << z << std::endl;
           this->send_packet (packets::play::make_unload_chunk (x, z));
+          this->send (this->curr_world.actor, unload_chunk_atom::value, x, z, this);
         }
     }
 
@@ -645,7 +657,7 @@ client_actor::update_chunks ()
           z < this->last_cpos.z - chunk_radius || z > this->last_cpos.z + chunk_radius)
         {
           //caf::aout (this) << "Sending chunk " << x << "," << z << std::endl;
-          this->send (this->curr_world.actor, request_chunk_data_atom::value, x, z, this->broker);
+          this->send (this->curr_world.actor, request_chunk_data_atom::value, x, z, this);
         }
     }
 
@@ -62,6 +62,16 @@ create_world_object (lua_State *L, scripting_actor *engine, const world_info& in
   lua_pushstring (L, "save");
   lua_pushcfunction (L, script::world_save);
   lua_settable (L, -3);
+
+  // world:pin_chunk()
+  lua_pushstring (L, "pin_chunk");
+  lua_pushcfunction (L, script::world_pin_chunk);
+  lua_settable (L, -3);
+
+  // world:unpin_chunk()
+  lua_pushstring (L, "unpin_chunk");
+  lua_pushcfunction (L, script::world_unpin_chunk);
+  lua_settable (L, -3);
 }
 
 void
@@ -179,6 +189,45 @@ world_save (lua_State *L)
   return 0;
 }
 
+//! \brief Sends a pin/unpin atom for the chunk given as arguments to the world.
+template<typename Atom>
+static int
+_world_send_chunk_pin (lua_State *L)
+{
+  int num_params = lua_gettop (L);
+  if (num_params != 3 || !script::is_world_object (L, -3)
+      || !lua_isinteger (L, -2) || !lua_isinteger (L, -1))
+    {
+      // TODO: invalid arguments
+      return 0;
+    }
+
+  auto engine = script::get_scripting_actor_from_object (L, -num_params);
+  auto id = (unsigned int)script::get_int_from_table (L, -num_params, "id");
+  auto info = engine->get_world_info (id);
+  if (!info)
+    return 0;
+
+  engine->send (info->actor, Atom::value, (int)lua_tointeger (L, -2), (int)lua_tointeger (L, -1));
+  return 0;
+}
+
+/*!
+ * Keeps the chunk at the specified chunk coordinates loaded until it is
+ * unpinned as many times as it was pinned.
+ */
+int
+world_pin_chunk (lua_State *L)
+{
+  return _world_send_chunk_pin<pin_chunk_atom> (L);
+}
+
+int
+world_unpin_chunk (lua_State *L)
+{
+  return _world_send_chunk_pin<unpin_chunk_atom> (L);
+}
+
 }
 
 
@@ -19,6 +19,7 @@
 #include "system/console.hpp"
 #include "system/atoms.hpp"
 #include "system/info.hpp"
+#include "system/metrics.hpp"
 #include <iostream>
 #include <thread>
 #include <chrono>
@@ -78,6 +79,8 @@ _console_thread_function (const caf::actor& srv)
       std::cin.getline (line, sizeof line);
       if (!std::strcmp (line, "stop"))
         break;
+      else if (!std::strcmp (line, "metrics"))
+        metrics::dump (std::cout);
     }
 
   _stop_server ();
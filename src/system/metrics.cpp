@@ -0,0 +1,95 @@
+/*
+ * Nostalgia - A custom Minecraft server.
+ * Copyright (C) 2019  Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "system/metrics.hpp"
+#include <map>
+#include <memory>
+#include <mutex>
+
+
+namespace metrics {
+
+  /*!
+   * Metrics are looked up from static initializers in other translation
+   * units, so the registry is constructed on first use.
+   */
+  struct registry
+  {
+    std::mutex mtx;
+    std::map<std::string, std::unique_ptr<counter>> counters;
+    std::map<std::string, std::unique_ptr<gauge>> gauges;
+  };
+
+  static registry&
+  _registry ()
+  {
+    static registry reg;
+    return reg;
+  }
+
+
+  void
+  gauge::add (int64_t n)
+  {
+    auto v = this->val.fetch_add (n, std::memory_order_relaxed) + n;
+    this->observe (v);
+  }
+
+  void
+  gauge::observe (int64_t v)
+  {
+    auto prev = this->peak.load (std::memory_order_relaxed);
+    while (v > prev && !this->peak.compare_exchange_weak (prev, v, std::memory_order_relaxed))
+      ;
+  }
+
+
+  counter&
+  get_counter (const std::string& name)
+  {
+    auto& reg = _registry ();
+    std::lock_guard<std::mutex> guard (reg.mtx);
+    auto& ptr = reg.counters[name];
+    if (!ptr)
+      ptr = std::make_unique<counter> ();
+    return *ptr;
+  }
+
+  gauge&
+  get_gauge (const std::string& name)
+  {
+    auto& reg = _registry ();
+    std::lock_guard<std::mutex> guard (reg.mtx);
+    auto& ptr = reg.gauges[name];
+    if (!ptr)
+      ptr = std::make_unique<gauge> ();
+    return *ptr;
+  }
+
+  void
+  dump (std::ostream& out)
+  {
+    auto& reg = _registry ();
+    std::lock_guard<std::mutex> guard (reg.mtx);
+    for (auto& p : reg.counters)
+      out << p.first << " = " << p.second->get () << std::endl;
+    for (auto& p : reg.gauges)
+      out << p.first << " = " << p.second->get ()
+          << " (peak " << p.second->high_water_mark () << ")" << std::endl;
+  }
+}
@@ -21,15 +21,17 @@
 #include "world/world.hpp"
 #include "system/consts.hpp"
 #include "world/generator_actor.hpp"
+#include "world/chunk_encoder.hpp"
 #include "network/packets.hpp"
+#include "network/packet_buffer.hpp"
 #include "world/blocks.hpp"
 #include "system/registries.hpp"
 #include "scripting/scripting.hpp"
 #include <filesystem>
 
 
-server_actor::server_actor (caf::actor_config& cfg, const caf::actor& script_eng)
-    : caf::event_based_actor (cfg), script_eng (script_eng)
+server_actor::server_actor (caf::actor_config& cfg, const caf::actor& script_eng, const server_settings& settings)
+    : caf::event_based_actor (cfg), script_eng (script_eng), settings (settings)
 {
   // nop
 }
@@ -53,11 +55,20 @@ server_actor::setup ()
   // load commands
   this->send (this->script_eng, load_commands_atom::value, "scripts/commands");
 
-  // spawn world generator actor
-  this->world_gen = this->system ().spawn<world_generator_actor> ();
+  // spawn world generator actors, so that several chunks can be generated at once
+  this->world_gen = caf::actor_pool::make (
+      this->system ().dummy_execution_unit (), this->settings.world_generator_workers,
+      [this] { return this->system ().spawn<world_generator_actor> (); }, caf::actor_pool::round_robin ());
+
+  // spawn chunk encoders, shared by all worlds
+  this->chunk_encoder = caf::actor_pool::make (
+      this->system ().dummy_execution_unit (), this->settings.chunk_encoder_workers,
+      [this] { return this->system ().spawn (chunk_encoder_impl); }, caf::actor_pool::round_robin ());
 
   // spawn main world
-  auto main_world = this->system ().spawn<world> (this->next_world_id, main_world_name, this, this->script_eng, this->world_gen);
+  auto main_world = this->system ().spawn<world> (this->next_world_id, main_world_name, this,
+                                                  this->script_eng, this->world_gen, this->chunk_encoder,
+                                                  this->settings.chunk_memory_budget);
   world_info info = { this->next_world_id, main_world, main_world_name };
   this->worlds[main_world_name] = info;
   ++ this->next_world_id;
@@ -163,22 +174,12 @@ server_actor::make_behavior ()
         return itr->second;
       },
 
-
-      [=] (broadcast_packet_atom, const std::vector<char>& buf) {
-        for (auto& p : this->connected_clients)
-          {
-            auto& cl = p.second.actor;
-            this->send (cl, packet_out_atom::value, buf);
-          }
-      },
-
       [=] (global_message_atom, const std::string& msg) {
-        auto packet = packets::play::make_chat_message_simple (msg, 0);
-        std::vector<char> packet_buf = packet.move_data ();
+        packet_buffer buf (packets::play::make_chat_message_simple (msg, 0));
         for (auto& p : this->connected_clients)
           {
             auto& cl = p.second.actor;
-            this->send (cl, packet_out_atom::value, packet_buf);
+            this->send (cl, packet_out_atom::value, buf);
           }
       }
   };
@@ -0,0 +1,55 @@
+/*
+ * Nostalgia - A custom Minecraft server.
+ * Copyright (C) 2019  Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "util/pack_array.hpp"
+#include <array>
+
+
+using pack_kernel = void (*) (const unsigned short *, size_t, uint64_t *);
+using unpack_kernel = void (*) (const uint64_t *, size_t, unsigned short *);
+
+template<size_t... I>
+static constexpr std::array<pack_kernel, 17>
+_make_pack_table (std::index_sequence<I...>)
+{
+  return { { nullptr, &pack_bits<I + 1>... } };
+}
+
+template<size_t... I>
+static constexpr std::array<unpack_kernel, 17>
+_make_unpack_table (std::index_sequence<I...>)
+{
+  return { { nullptr, &unpack_bits<I + 1>... } };
+}
+
+// kernels indexed by the number of bits per element
+static constexpr auto _pack_kernels = _make_pack_table (std::make_index_sequence<16> ());
+static constexpr auto _unpack_kernels = _make_unpack_table (std::make_index_sequence<16> ());
+
+
+void
+pack_array (const unsigned short *in, size_t len, uint64_t *out, unsigned int bits_per_element)
+{
+  _pack_kernels[bits_per_element] (in, len, out);
+}
+
+void
+unpack_array (const uint64_t *in, size_t len, unsigned short *out, unsigned int bits_per_element)
+{
+  _unpack_kernels[bits_per_element] (in, len, out);
+}
@@ -17,93 +17,470 @@
  */
 
 #include "world/chunk.hpp"
+#include "world/palette.hpp"
 #include "system/consts.hpp"
 #include "world/blocks.hpp"
 #include "util/nbt.hpp"
 #include "util/pack_array.hpp"
+#include "world/section_pool.hpp"
 #include <set>
+#include <algorithm>
+#include <iterator>
+#include <cstring>
+#include <atomic>
+
+
+//! \brief Reads the idx'th packed entry of the specified width.
+static inline unsigned int
+_get_entry (const uint64_t *data, unsigned int bits, unsigned int idx)
+{
+  auto offset = idx * bits;
+  auto word = offset >> 6;
+  auto shift = offset & 63;
+
+  uint64_t val = data[word] >> shift;
+  if (shift + bits > 64)
+    val |= data[word + 1] << (64 - shift); // entry spans two words
+
+  return (unsigned int)(val & ((1ULL << bits) - 1));
+}
+
+//! \brief Overwrites the idx'th packed entry of the specified width.
+static inline void
+_set_entry (uint64_t *data, unsigned int bits, unsigned int idx, unsigned int val)
+{
+  auto offset = idx * bits;
+  auto word = offset >> 6;
+  auto shift = offset & 63;
+  auto mask = (1ULL << bits) - 1;
+
+  data[word] = (data[word] & ~(mask << shift)) | ((uint64_t)val << shift);
+  if (shift + bits > 64)
+    {
+      auto rest = shift + bits - 64;
+      auto rest_mask = (1ULL << rest) - 1;
+      data[word + 1] = (data[word + 1] & ~rest_mask) | ((uint64_t)val >> (64 - shift));
+    }
+}
 
 
 chunk_section::chunk_section ()
+  : palette { 0 }, data (4096 * 4 / 64, 0), bits (4)
+{
+  // nop
+}
+
+const std::shared_ptr<chunk_section>&
+chunk_section::empty ()
 {
-  std::memset (this->ids, 0, sizeof this->ids);
-  std::memset (this->block_light, 0, sizeof this->block_light);
-  std::memset (this->sky_light, 0, sizeof this->sky_light);
+  static const std::shared_ptr<chunk_section> section = [] {
+    auto ptr = std::make_shared<chunk_section> ();
+    ptr->sky_light_fill = 15;
+    return ptr;
+  } ();
+
+  return section;
 }
 
 
-static unsigned int
-_ilog2 (int n)
+chunk_section::shared_state::shared_state (const shared_state& other)
+  : encoded (std::atomic_load (&other.encoded))
 {
-  unsigned int r = 0;
-  while (n > 1)
+  // copies are not pooled
+}
+
+chunk_section::shared_state&
+chunk_section::shared_state::operator= (const shared_state& other)
+{
+  std::atomic_store (&this->encoded, std::atomic_load (&other.encoded));
+  this->pooled = false;
+  return *this;
+}
+
+//! \brief Returns the section the way it appears in CHUNK DATA packets.
+std::shared_ptr<const std::vector<char>>
+chunk_section::encode () const
+{
+  // threads sharing the section may race to encode it, which is harmless
+  if (auto encoded = std::atomic_load (&this->shared.encoded))
+    return encoded;
+
+  packet_writer writer;
+  writer.reserve ((unsigned)(this->palette.size () * 3 + this->data.size () * 8 + 16));
+  writer.write_short ((uint16_t)this->non_air);
+  writer.write_byte ((uint8_t)this->bits);
+
+  // palette (none in direct mode)
+  if (!this->palette.empty ())
     {
-      n >>= 1;
-      ++ r;
+      writer.write_varlong (this->palette.size ());
+      for (auto id : this->palette)
+        writer.write_varlong (id);
     }
-  return r;
+
+  // the section is already packed the way the client expects it
+  writer.write_varlong (this->data.size ());
+  for (uint64_t v : this->data)
+    writer.write_long (v);
+
+  auto encoded = std::make_shared<const std::vector<char>> (writer.data (), writer.data () + writer.position ());
+  std::atomic_store (&this->shared.encoded, encoded);
+  return encoded;
 }
 
-unsigned int
-chunk_palette::compute_bits_per_block () const
+//! \brief Returns an estimate of the memory taken up by the section, in bytes.
+size_t
+chunk_section::memory_usage () const
 {
-  auto num = this->num_blocks ();
-  if (num == 0)
-    return 4;
+  size_t bytes = sizeof (chunk_section)
+                 + this->palette.capacity () * sizeof (unsigned short)
+                 + this->data.capacity () * sizeof (uint64_t)
+                 + this->block_light.capacity () + this->sky_light.capacity ();
+  if (auto encoded = std::atomic_load (&this->shared.encoded))
+    bytes += encoded->capacity ();
+  return bytes;
+}
 
-  auto res = _ilog2 (num);
-  if ((num & (num - 1)) != 0)
-    ++ res; // num_blocks is not a perfect power of two
+static inline uint64_t
+_mix (uint64_t h, uint64_t v)
+{
+  h = (h ^ v) * 0x9E3779B97F4A7C15ULL;
+  return h ^ (h >> 29);
+}
 
-  if (res < 4)
-    res = 4; // there must be at least 4 bits per block
+static uint64_t
+_mix_bytes (uint64_t h, const std::vector<unsigned char>& arr)
+{
+  size_t i = 0;
+  for (; i + 8 <= arr.size (); i += 8)
+    {
+      uint64_t word;
+      std::memcpy (&word, arr.data () + i, 8);
+      h = _mix (h, word);
+    }
+  for (; i < arr.size (); ++i)
+    h = _mix (h, arr[i]);
+  return h;
+}
 
-  return res;
+//! \brief Returns a hash of the section's blocks and light.
+uint64_t
+chunk_section::hash () const
+{
+  uint64_t h = _mix (this->bits, this->palette.size ());
+  for (auto id : this->palette)
+    h = _mix (h, id);
+  for (auto word : this->data)
+    h = _mix (h, word);
+
+  h = _mix (h, this->block_light_fill | (this->sky_light_fill << 8));
+  h = _mix_bytes (h, this->block_light);
+  h = _mix (h, this->block_light.size ());
+  h = _mix_bytes (h, this->sky_light);
+  return _mix (h, this->sky_light.size ());
 }
 
-chunk_palette
-chunk_section::generate_palette () const
+bool
+chunk_section::operator== (const chunk_section& other) const
 {
-  chunk_palette palette;
+  return this->bits == other.bits
+         && this->palette == other.palette
+         && this->data == other.data
+         && this->block_light_fill == other.block_light_fill
+         && this->sky_light_fill == other.sky_light_fill
+         && this->block_light == other.block_light
+         && this->sky_light == other.sky_light;
+}
 
-  for (unsigned short id : this->ids)
-  {
-    if (palette.index_map.find (id) == palette.index_map.end ())
-      {
-        palette.index_map[id] = (unsigned short)palette.ids.size ();
-        palette.ids.push_back (id);
-      }
-  }
+unsigned short
+chunk_section::get_id (unsigned int idx) const
+{
+  auto val = _get_entry (this->data.data (), this->bits, idx);
+  return this->palette.empty () ? (unsigned short)val : this->palette[val];
+}
+
+void
+chunk_section::set_id (unsigned int idx, unsigned short id)
+{
+  auto prev = this->get_id (idx);
+  if (prev == id)
+    return;
+  this->non_air += (int)(id != 0) - (int)(prev != 0);
+  this->shared.encoded.reset ();
+
+  if (this->palette.empty ())
+    {
+      _set_entry (this->data.data (), this->bits, idx, id);
+      return;
+    }
+
+  // find block in palette
+  unsigned int pidx = 0;
+  auto num = (unsigned int)this->palette.size ();
+  while (pidx < num && this->palette[pidx] != id)
+    ++ pidx;
+
+  if (pidx == num)
+    {
+      // new block, make room for it
+      if (num == (1U << this->bits))
+        {
+          if (this->bits == max_indirect_bits_per_block)
+            {
+              this->repack (direct_bits_per_block);
+              _set_entry (this->data.data (), this->bits, idx, id);
+              return;
+            }
+
+          this->repack (this->bits + 1);
+        }
+
+      this->palette.push_back (id);
+    }
 
-  return palette;
+  _set_entry (this->data.data (), this->bits, idx, pidx);
 }
 
-//! \brief Returns the number of non air blocks present in the section.
-int
-chunk_section::count_non_air_blocks () const
+//! \brief Copies all 4096 block ids into the specified array.
+void
+chunk_section::get_ids (unsigned short *out) const
 {
-  int count = 0;
-  for (unsigned short id : this->ids)
-    if (id != 0)
-      ++ count;
-  return count;
+  unpack_array (this->data.data (), 4096, out, this->bits);
+  if (!this->palette.empty ())
+    {
+      auto palette = this->palette.data ();
+      for (unsigned int i = 0; i < 4096; ++i)
+        out[i] = palette[out[i]];
+    }
+}
+
+//! \brief Counts the non-zero entries of the specified array.
+static int
+_count_non_zero (const unsigned short *ids, unsigned int count)
+{
+  unsigned int i = 0;
+  int zeros = 0;
+
+#ifdef NOSTALGIA_HAVE_SSE2
+  // each 16-bit lane counts the zeros it sees (compare yields -1 per match)
+  auto zero = _mm_setzero_si128 ();
+  auto acc = _mm_setzero_si128 ();
+  for (; i + 8 <= count; i += 8)
+    {
+      auto v = _mm_loadu_si128 ((const __m128i *)(ids + i));
+      acc = _mm_sub_epi16 (acc, _mm_cmpeq_epi16 (v, zero));
+    }
+
+  // lanes count up to count / 8 zeros, which fits in 16 bits for a section
+  alignas(16) unsigned short lanes[8];
+  _mm_store_si128 ((__m128i *)lanes, acc);
+  for (auto lane : lanes)
+    zeros += lane;
+#endif
+
+  for (; i < count; ++i)
+    if (ids[i] == 0)
+      ++ zeros;
+
+  return (int)count - zeros;
+}
+
+//! \brief Replaces all blocks in the section with the 4096 specified block ids.
+void
+chunk_section::set_ids (const unsigned short *ids)
+{
+  this->non_air = _count_non_zero (ids, 4096);
+  this->shared.encoded.reset ();
+
+  unsigned short indices[4096];
+  auto num = palette_builder::local ().build (ids, 4096, this->palette, indices);
+  auto bits = palette_bits_per_block (num);
+
+  if (bits > max_indirect_bits_per_block)
+    {
+      this->palette.clear ();
+      this->bits = direct_bits_per_block;
+      this->data.resize (4096 * direct_bits_per_block / 64);
+      pack_array (ids, 4096, this->data.data (), direct_bits_per_block);
+    }
+  else
+    {
+      this->bits = bits;
+      this->data.resize (4096 * bits / 64);
+      pack_array (indices, 4096, this->data.data (), bits);
+    }
+}
+
+//! \brief Repacks the section using the specified number of bits per block.
+void
+chunk_section::repack (unsigned int new_bits)
+{
+  unsigned short ids[4096];
+  bool direct = new_bits > max_indirect_bits_per_block;
+  if (direct)
+    this->get_ids (ids); // indices are replaced by block ids
+  else
+    unpack_array (this->data.data (), 4096, ids, this->bits);
+
+  this->bits = new_bits;
+  this->data.resize (4096 * new_bits / 64);
+  pack_array (ids, 4096, this->data.data (), new_bits);
+
+  if (direct)
+    this->palette.clear ();
+}
+
+static inline unsigned char
+_get_nibble (const std::vector<unsigned char>& arr, unsigned char fill, unsigned int idx)
+{
+  if (arr.empty ())
+    return fill;
+
+  auto half = idx >> 1;
+  return (idx & 1) ? (arr[half] >> 4) : (arr[half] & 0xf);
+}
+
+static inline void
+_set_nibble (std::vector<unsigned char>& arr, unsigned char fill, unsigned int idx, unsigned char val)
+{
+  if (arr.empty ())
+    {
+      if (val == fill)
+        return;
+      arr.assign (2048, (unsigned char)(fill | (fill << 4)));
+    }
+
+  auto half = idx >> 1;
+  if (idx & 1)
+    arr[half] = (arr[half] & 0x0F) | (val << 4);
+  else
+    arr[half] = (arr[half] & 0xF0) | val;
+}
+
+unsigned char
+chunk_section::get_block_light (unsigned int idx) const
+{
+  return _get_nibble (this->block_light, this->block_light_fill, idx);
+}
+
+void
+chunk_section::set_block_light (unsigned int idx, unsigned char val)
+{
+  _set_nibble (this->block_light, this->block_light_fill, idx, val);
+}
+
+unsigned char
+chunk_section::get_sky_light (unsigned int idx) const
+{
+  return _get_nibble (this->sky_light, this->sky_light_fill, idx);
+}
+
+void
+chunk_section::set_sky_light (unsigned int idx, unsigned char val)
+{
+  _set_nibble (this->sky_light, this->sky_light_fill, idx, val);
 }
 
 
 
 chunk::chunk (int x, int z)
-  : x (x), z (z), sections (16)
+  : x (x), z (z)
 {
+  for (auto& section : this->sections)
+    section = chunk_section::empty ();
+
   for (int& b : this->biomes)
     b = 1;
+
+  // no blocks yet
+  for (auto& height_map : this->height_maps)
+    std::fill (std::begin (height_map), std::end (height_map), 0);
+}
+
+
+//! \brief Returns a section that can be modified, copying it first if it is shared.
+chunk_section&
+chunk::own_section (unsigned idx)
+{
+  ++ this->version;
+
+  // pooled sections may be handed to other chunks at any time
+  auto& ptr = this->sections[idx];
+  if (ptr.use_count () > 1 || ptr->is_pooled ())
+    ptr = std::make_shared<chunk_section> (*ptr);
+  else
+    {
+      // the last snapshot (e.g. one being encoded) may have been dropped on
+      // another thread, whose reads must happen before the writes below.
+      std::atomic_thread_fence (std::memory_order_acquire);
+    }
+  return *ptr;
+}
+
+//! \brief Marks a section as present, creating one like chunk_section::empty () if necessary.
+void
+chunk::add_section (unsigned idx)
+{
+  if (this->section_bitmap & (1U << idx))
+    return;
+
+  // starts out lit the way it was while missing
+  this->sections[idx] = std::make_shared<chunk_section> (*chunk_section::empty ());
+  this->section_bitmap |= 1U << idx;
+}
+
+//! \brief Frees the specified section if it holds nothing but air and has default light.
+void
+chunk::release_if_empty (unsigned idx)
+{
+  if (!(this->section_bitmap & (1U << idx)))
+    return;
+
+  auto& section = *this->sections[idx];
+  // must not change the light reported for the section
+  if (!section.has_default_light () || section.count_non_air_blocks () != 0)
+    return;
+
+  this->sections[idx] = chunk_section::empty ();
+  this->section_bitmap &= ~(1U << idx);
+}
+
+//! \brief Replaces the chunk's sections with identical ones from the section pool, if there are any.
+void
+chunk::pool_sections ()
+{
+  auto& pool = section_pool::global ();
+  for (unsigned y = 0; y < 16; ++y)
+    if (this->section_bitmap & (1U << y))
+      this->sections[y] = pool.intern (this->sections[y]);
+}
+
+//! \brief Returns an estimate of the memory taken up by the chunk, in bytes.
+size_t
+chunk::memory_usage () const
+{
+  size_t bytes = sizeof (chunk) + this->heightmap_cache.capacity ();
+  for (unsigned y = 0; y < 16; ++y)
+    if ((this->section_bitmap & (1U << y)) && !this->sections[y]->is_pooled ())
+      bytes += this->sections[y]->memory_usage ();
+  return bytes;
 }
 
 
 void
 chunk::set_block_id_unsafe (int x, int y, int z, unsigned short id)
 {
-  this->sections[y >> 4].ids[((y & 0xf) << 8) | (z << 4) | (15 - x)] = id;
-  this->section_bitmap |= (1 << (y >> 4));
+  auto idx = (unsigned)y >> 4;
+  if (!(this->section_bitmap & (1U << idx)))
+    {
+      if (id == 0)
+        return; // already air
+      this->add_section (idx);
+    }
+
+  this->own_section (idx).set_id (((y & 0xf) << 8) | (z << 4) | x, id);
+  if (this->height_maps_valid)
+    this->update_height_maps (x, y, z, id);
 }
 
 void
@@ -118,9 +495,7 @@ chunk::set_block_id (int x, int y, int z, unsigned short id)
 unsigned short
 chunk::get_block_id_unsafe (int x, int y, int z)
 {
-  if (this->section_bitmap & (1 << (y >> 4)))
-    return this->sections[y >> 4].ids[((y & 0xf) << 8) | (z << 4) | (15 - x)];
-  return 0;
+  return this->sections[y >> 4]->get_id (((y & 0xf) << 8) | (z << 4) | x);
 }
 
 unsigned short
@@ -136,13 +511,10 @@ void
 chunk::set_sky_light_unsafe (int x, int y, int z, unsigned char val)
 {
   auto idx = ((y & 0xf) << 8) | (z << 4) | x;
-  auto half = idx >> 1;
-  auto& section = this->sections[y >> 4];
-  if (idx & 1)
-    section.sky_light[half] = (section.sky_light[half] & 0x0F) | (val << 4);
-  else
-    section.sky_light[half] = (section.sky_light[half] & 0xF0) | val;
+  if (this->sections[y >> 4]->get_sky_light (idx) == val)
+    return; // nothing to do (and nothing to copy)
 
+  this->own_section (y >> 4).set_sky_light (idx, val);
   this->section_bitmap |= (1 << (y >> 4));
 }
 
@@ -158,17 +530,7 @@ chunk::set_sky_light (int x, int y, int z, unsigned char val)
 unsigned char
 chunk::get_sky_light_unsafe (int x, int y, int z)
 {
-  if ((this->section_bitmap & (1 << (y >> 4))) == 0)
-    return 15;
-
-  auto idx = ((y & 0xf) << 8) | (z << 4) | x;
-  auto half = idx >> 1;
-  auto& section = this->sections[y >> 4];
-  if (idx & 1)
-    return section.sky_light[half] >> 4;
-  else
-    return section.sky_light[half] & 0xf;
-
+  return this->sections[y >> 4]->get_sky_light (((y & 0xf) << 8) | (z << 4) | x);
 }
 
 unsigned char
@@ -184,13 +546,10 @@ void
 chunk::set_block_light_unsafe (int x, int y, int z, unsigned char val)
 {
   auto idx = ((y & 0xf) << 8) | (z << 4) | x;
-  auto half = idx >> 1;
-  auto& section = this->sections[y >> 4];
-  if (idx & 1)
-    section.block_light[half] = (section.block_light[half] & 0x0F) | (val << 4);
-  else
-    section.block_light[half] = (section.block_light[half] & 0xF0) | val;
+  if (this->sections[y >> 4]->get_block_light (idx) == val)
+    return; // nothing to do (and nothing to copy)
 
+  this->own_section (y >> 4).set_block_light (idx, val);
   this->section_bitmap |= (1 << (y >> 4));
 }
 
@@ -204,128 +563,247 @@ chunk::set_block_light (int x, int y, int z, unsigned char val)
 }
 
 
-packet_writer
-chunk::make_chunk_data_packet ()
+//! \brief Checks whether the specified block counts towards the given height map.
+static inline bool
+_counts_towards (height_map_type type, unsigned short id)
 {
-  packet_writer writer;
+  switch (type)
+    {
+    case height_map_type::motion_blocking: return !is_transparent_block (id);
+    case height_map_type::world_surface: return id != 0;
+    }
+
+  return false;
+}
+
+//! \brief Scans the column down from y for the highest block that counts towards the given height map.
+unsigned short
+chunk::scan_height (height_map_type type, int x, int y, int z)
+{
+  while (y >= 0)
+    {
+      if (!(this->section_bitmap & (1U << (y >> 4))))
+        {
+          // missing sections are all air, skip to the one below
+          y = (y & ~15) - 1;
+          continue;
+        }
+
+      if (_counts_towards (type, this->get_block_id_unsafe (x, y, z)))
+        return (unsigned short)(y + 1);
+      -- y;
+    }
+
+  return 0;
+}
+
+//! \brief Recomputes all height maps from scratch.
+void
+chunk::rebuild_height_maps ()
+{
+  for (int t = 0; t < num_height_map_types; ++t)
+    for (int z = 0; z < 16; ++z)
+      for (int x = 0; x < 16; ++x)
+        this->height_maps[t][(z << 4) | x] = this->scan_height ((height_map_type)t, x, 255, z);
+
+  this->height_maps_valid = true;
+  this->heightmap_cached = false;
+}
+
+//! \brief Updates the height maps after the block at the specified position was changed.
+void
+chunk::update_height_maps (int x, int y, int z, unsigned short id)
+{
+  for (int t = 0; t < num_height_map_types; ++t)
+    {
+      auto& height = this->height_maps[t][(z << 4) | x];
+      if (_counts_towards ((height_map_type)t, id))
+        {
+          if (y < height)
+            continue; // placed below the top of the column
+
+          height = (unsigned short)(y + 1);
+        }
+      else
+        {
+          if (y + 1 != height)
+            continue; // the top of the column is still there
+
+          // the top block was removed, look for the next one below it
+          height = this->scan_height ((height_map_type)t, x, y - 1, z);
+        }
+
+      this->heightmap_cached = false;
+    }
+}
+
+unsigned short
+chunk::get_height (height_map_type type, int x, int z)
+{
+  if (x < 0 || x >= 16) return 0;
+  if (z < 0 || z >= 16) return 0;
+
+  if (!this->height_maps_valid)
+    this->rebuild_height_maps ();
+  return this->height_maps[(int)type][(z << 4) | x];
+}
+
+
+//! \brief Returns the cached height map NBT, creating it if necessary.
+const std::vector<char>&
+chunk::encode_height_map ()
+{
+  if (this->heightmap_cached)
+    return this->heightmap_cache;
+  if (!this->height_maps_valid)
+    this->rebuild_height_maps ();
 
-  // generate NBT structure holding height map
-  int height_map[256];
-  this->compute_height_map (height_map);
+  // generate NBT structure holding height maps
   nbt_writer heightmap_nbt;
   heightmap_nbt.start_compound ("");
 
   uint64_t height_map_packed[36];
-  pack_array (height_map, 256, height_map_packed, 9);
+  pack_bits<9> (this->height_maps[(int)height_map_type::motion_blocking], 256, height_map_packed);
   heightmap_nbt.push_long_array (height_map_packed, 36, "MOTION_BLOCKING");
+  pack_bits<9> (this->height_maps[(int)height_map_type::world_surface], 256, height_map_packed);
+  heightmap_nbt.push_long_array (height_map_packed, 36, "WORLD_SURFACE");
 
   heightmap_nbt.end_compound ();
 
-  // preprocess sections
-  int bitmask = 0;
-  int data_size = 1024; // account for biome array
-  std::vector<chunk_palette> palettes (16);
-  for (int y = 0; y < 16; ++y)
-    if (this->section_bitmap & (1 << y))
-      {
-        auto& section = this->sections[y];
-        bitmask |= 1 << y;
-        palettes[y] = section.generate_palette ();
+  auto& data = heightmap_nbt.buffer ();
+  this->heightmap_cache.assign (data.begin (), data.end ());
+  this->heightmap_cached = true;
+  return this->heightmap_cache;
+}
 
-        auto& palette = palettes[y];
-        auto bits_per_block = palette.compute_bits_per_block ();
+packet_writer
+chunk::make_chunk_data_packet (unsigned int section_mask)
+{
+  packet_writer writer;
+  bool full = (section_mask & 0xFFFF) == 0xFFFF;
+  section_mask &= this->section_bitmap;
 
-        data_size += 2; // number of non-air blocks
-        data_size += 1; // bits per block
-        if (bits_per_block <= 8)
-          {
-            data_size += varlong_size (palette.num_blocks ());
-            for (unsigned short id : palette.ids)
-              data_size += varlong_size (id);
-          }
+  auto& heightmap = this->encode_height_map ();
 
-        data_size += varlong_size (bits_per_block * 512); // data array length
-        data_size += bits_per_block * 512; // data array
+  // encode sections
+  std::shared_ptr<const std::vector<char>> encoded[16];
+  int data_size = full ? 1024 : 0; // account for biome array
+  for (unsigned y = 0; y < 16; ++y)
+    if (section_mask & (1U << y))
+      {
+        encoded[y] = this->sections[y]->encode ();
+        data_size += (int)encoded[y]->size ();
       }
 
+  writer.reserve (data_size + (unsigned)heightmap.size () + 32);
   writer.write_varlong (OPI_CHUNK_DATA);
   writer.write_int (this->x);
   writer.write_int (this->z);
-  writer.write_bool (true);
-  writer.write_varlong (bitmask);
-  writer.write_nbt (heightmap_nbt);
+  writer.write_bool (full);
+  writer.write_varlong (section_mask);
+  writer.write_bytes (heightmap.data (), (unsigned)heightmap.size ());
   writer.write_varlong (data_size);
 
   // data
-  for (int y = 0; y < 16; ++y)
-    {
-      if (!(this->section_bitmap & (1 << y)))
-        continue;
-      const auto& section = this->sections[y];
-
-      writer.write_short (section.count_non_air_blocks ());
+  for (unsigned y = 0; y < 16; ++y)
+    if (section_mask & (1U << y))
+      {
+        auto& data = *encoded[y];
+        writer.write_bytes (data.data (), (unsigned)data.size ());
+      }
 
-      // generate palette
-      auto& palette = palettes[y];
-      auto bits_per_block = palette.compute_bits_per_block ();
-      writer.write_byte ((char)bits_per_block);
+  // biomes (only sent along with full chunks)
+  if (full)
+    for (int b : this->biomes)
+      writer.write_int (b);
 
-      bool direct = bits_per_block > 8;
-      if (!direct)
-        {
-          // indirect mode
-          writer.write_varlong (palette.num_blocks ());
-          for (auto id : palette.ids)
-            writer.write_varlong (id);
-        }
-      else
-        {
-          // direct mode - no palette
-        }
+  writer.write_varlong (0); // number of block entities
 
-      writer.write_varlong (bits_per_block * 64); // data array length
+  return writer;
+}
 
-      // prepare unpacked array for packing
-      unsigned short raw[4096];
-      if (direct)
-        std::memcpy (raw, section.ids, 4096);
-      else
-        {
-          for (int i = 0; i < 4096; ++i)
-            raw[i] = palette.index_map[section.ids[i]];
-        }
 
-      // pack
-      std::vector<uint64_t> packed (bits_per_block * 64, 0);
-      pack_array<unsigned short, uint64_t> (raw, 4096, packed.data (), bits_per_block);
-      for (uint64_t v : packed)
-        writer.write_long (v);
+//! \brief Writes a light array (with its length) the way UPDATE LIGHT packets expect it.
+static void
+_write_light (packet_writer& writer, const std::vector<unsigned char>& arr, unsigned char fill)
+{
+  writer.write_varlong (2048);
+  if (!arr.empty ())
+    {
+      writer.write_bytes ((const char *)arr.data (), 2048);
+      return;
     }
 
-  // biomes
-  for (int b : this->biomes)
-    writer.write_int (b);
+  // uniform light, expand it
+  char filled[2048];
+  std::memset (filled, fill | (fill << 4), sizeof filled);
+  writer.write_bytes (filled, sizeof filled);
+}
 
-  writer.write_varlong (0); // number of block entities
+packet_writer
+chunk::make_update_light_packet (unsigned int section_mask)
+{
+  // light masks have 18 bits: bit 0 is the section below the world and bit
+  // 17 the one above it, neither of which are ever sent.
+  unsigned int sky_mask = 0, block_mask = 0;
+  unsigned int empty_sky_mask = 0, empty_block_mask = 0;
+  int num_arrays = 0;
+  for (unsigned y = 0; y < 16; ++y)
+    if (section_mask & (1U << y))
+      {
+        auto& section = *this->sections[y];
+        auto bit = 1U << (y + 1);
+
+        if (section.get_sky_light_data ().empty () && section.get_sky_light_fill () == 0)
+          empty_sky_mask |= bit;
+        else
+          sky_mask |= bit, ++ num_arrays;
+
+        if (section.get_block_light_data ().empty () && section.get_block_light_fill () == 0)
+          empty_block_mask |= bit;
+        else
+          block_mask |= bit, ++ num_arrays;
+      }
+
+  packet_writer writer;
+  writer.reserve (num_arrays * (2048 + 2) + 32);
+  writer.write_varlong (OPI_UPDATE_LIGHT);
+  writer.write_varlong ((uint32_t)this->x); // varints, so no sign extension
+  writer.write_varlong ((uint32_t)this->z);
+  writer.write_varlong (sky_mask);
+  writer.write_varlong (block_mask);
+  writer.write_varlong (empty_sky_mask);
+  writer.write_varlong (empty_block_mask);
+
+  for (unsigned y = 0; y < 16; ++y)
+    if (sky_mask & (1U << (y + 1)))
+      {
+        auto& section = *this->sections[y];
+        _write_light (writer, section.get_sky_light_data (), section.get_sky_light_fill ());
+      }
+
+  for (unsigned y = 0; y < 16; ++y)
+    if (block_mask & (1U << (y + 1)))
+      {
+        auto& section = *this->sections[y];
+        _write_light (writer, section.get_block_light_data (), section.get_block_light_fill ());
+      }
 
   return writer;
 }
 
 
-
 //! \brief Computes sky/block lighting for the blocks in chunk.
 void
 chunk::compute_initial_lighting ()
 {
-  int height_map[256];
-  this->compute_height_map (height_map);
-
   // all transparent blocks with direct vertical contact with sunlight
   // get skylight value of 15.
   for (int x = 0; x < 16; ++x)
     for (int z = 0; z < 16; ++z)
       {
-        for (int y = 255; y > height_map[x * 16 + z]; --y)
+        int top = this->get_highest_block (x, z);
+        for (int y = 255; y > top; --y)
           {
             if (this->section_bitmap & (1 << (y >> 4)))
               {
@@ -335,22 +813,3 @@ chunk::compute_initial_lighting ()
       }
 
 }
-
-//! \brief Fills the specified height map array with the correct values.
-void
-chunk::compute_height_map (int height_map[256])
-{
-  for (int x = 0; x < 16; ++x)
-    for (int z = 0; z < 16; ++z)
-      {
-        height_map[x * 16 + z] = -1;
-        for (int y = 255; y >= 0; --y)
-          {
-            if (!is_transparent_block (this->get_block_id_unsafe (x, y, z)))
-              {
-                height_map[x * 16 + z] = y;
-                break;
-              }
-          }
-      }
-}
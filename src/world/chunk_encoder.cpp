@@ -0,0 +1,40 @@
+/*
+ * Nostalgia - A custom Minecraft server.
+ * Copyright (C) 2019  Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "world/chunk_encoder.hpp"
+#include "world/chunk.hpp"
+#include "system/atoms.hpp"
+#include "system/metrics.hpp"
+
+
+static metrics::counter& _encoded_chunks = metrics::get_counter ("chunk_encoder.chunks");
+
+caf::behavior
+chunk_encoder_impl (caf::event_based_actor *self)
+{
+  return {
+    [=] (encode_chunk_atom, chunk& ch, const caf::actor& broker) {
+      // light goes first, so the chunk is lit as soon as it appears
+      self->send (broker, packet_out_atom::value, ch.make_update_light_packet ().move_data ());
+      self->send (broker, packet_out_atom::value, ch.make_chunk_data_packet ().move_data ());
+      _encoded_chunks.add ();
+
+      return caf::make_message (chunk_encoded_atom::value, ch.get_x (), ch.get_z (), ch.get_version (), broker);
+    }
+  };
+}
@@ -0,0 +1,131 @@
+/*
+ * Nostalgia - A custom Minecraft server.
+ * Copyright (C) 2019  Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "world/chunk_map.hpp"
+
+
+static constexpr unsigned int initial_slot_bits = 6;
+
+chunk_map::chunk_map ()
+  : slots (1U << initial_slot_bits), shift (64 - initial_slot_bits)
+{
+  // nop
+}
+
+
+chunk*
+chunk_map::find_slow (uint64_t key)
+{
+  auto mask = this->slots.size () - 1;
+  for (auto i = this->home (key); ; i = (i + 1) & mask)
+    {
+      auto& s = this->slots[i];
+      if (!s.ch)
+        return nullptr;
+      if (s.key == key)
+        {
+          this->last_key = key;
+          this->last = s.ch.get ();
+          return this->last;
+        }
+    }
+}
+
+chunk*
+chunk_map::insert (int cx, int cz, std::unique_ptr<chunk> ch)
+{
+  // keep the load factor at or below one half
+  if ((this->count + 1) * 2 > this->slots.size ())
+    this->grow ();
+
+  auto key = pack_chunk_key (cx, cz);
+  auto mask = this->slots.size () - 1;
+  for (auto i = this->home (key); ; i = (i + 1) & mask)
+    {
+      auto& s = this->slots[i];
+      if (!s.ch)
+        {
+          s.key = key;
+          s.ch = std::move (ch);
+          ++ this->count;
+          return s.ch.get ();
+        }
+
+      if (s.key == key)
+        return s.ch.get (); // already present
+    }
+}
+
+bool
+chunk_map::erase (int cx, int cz)
+{
+  auto key = pack_chunk_key (cx, cz);
+  auto mask = this->slots.size () - 1;
+
+  size_t i = this->home (key);
+  for (; ; i = (i + 1) & mask)
+    {
+      auto& s = this->slots[i];
+      if (!s.ch)
+        return false;
+      if (s.key == key)
+        break;
+    }
+
+  if (this->last_key == key)
+    this->last = nullptr;
+  this->slots[i].ch.reset ();
+  -- this->count;
+
+  // shift back entries that would no longer be reachable past the hole
+  for (auto j = (i + 1) & mask; this->slots[j].ch; j = (j + 1) & mask)
+    {
+      auto k = this->home (this->slots[j].key);
+
+      // entry j may move into hole i unless its home lies cyclically in (i, j]
+      bool reachable = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+      if (reachable)
+        continue;
+
+      this->slots[i] = std::move (this->slots[j]);
+      i = j;
+    }
+
+  return true;
+}
+
+//! \brief Doubles the number of slots.
+void
+chunk_map::grow ()
+{
+  std::vector<slot> old (this->slots.size () * 2);
+  old.swap (this->slots);
+  -- this->shift;
+
+  auto mask = this->slots.size () - 1;
+  for (auto& s : old)
+    if (s.ch)
+      {
+        auto i = this->home (s.key);
+        while (this->slots[i].ch)
+          i = (i + 1) & mask;
+        this->slots[i] = std::move (s);
+      }
+
+  // chunks do not move, so the last chunk found is still valid
+}
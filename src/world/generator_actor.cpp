@@ -46,6 +46,9 @@ world_generator_actor::act ()
             }
 
         ch.compute_initial_lighting ();
+
+        // generated terrain is very repetitive
+        ch.pool_sections ();
         return ch;
       },
 
@@ -0,0 +1,81 @@
+/*
+ * Nostalgia - A custom Minecraft server.
+ * Copyright (C) 2019  Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "world/palette.hpp"
+#include <algorithm>
+
+
+//! \brief Returns the number of bits per block needed for a palette of the specified size.
+unsigned int
+palette_bits_per_block (unsigned int num_blocks)
+{
+  unsigned int res = 4; // there must be at least 4 bits per block
+  while ((1U << res) < num_blocks)
+    ++ res;
+  return res;
+}
+
+
+palette_builder::palette_builder ()
+  : table (65536, 0)
+{
+  // nop
+}
+
+//! \brief Returns a builder owned by the calling thread.
+palette_builder&
+palette_builder::local ()
+{
+  static thread_local palette_builder builder;
+  return builder;
+}
+
+//! \brief Builds the palette of the specified block ids.
+unsigned int
+palette_builder::build (const unsigned short *ids, size_t count,
+                        std::vector<unsigned short>& palette, unsigned short *indices)
+{
+  // generations are 16 bits wide, start over once they run out
+  if (++ this->generation == 0x10000)
+    {
+      std::fill (this->table.begin (), this->table.end (), 0);
+      this->generation = 1;
+    }
+
+  auto table = this->table.data ();
+  auto stamp = this->generation << 16;
+  unsigned int num = 0;
+
+  palette.clear ();
+  for (size_t i = 0; i < count; ++i)
+    {
+      auto id = ids[i];
+      auto entry = table[id];
+      if ((entry & 0xFFFF0000U) != stamp)
+        {
+          // first time this block is seen
+          entry = stamp | num ++;
+          table[id] = entry;
+          palette.push_back (id);
+        }
+
+      indices[i] = (unsigned short)(entry & 0xFFFF);
+    }
+
+  return num;
+}
@@ -30,3 +30,45 @@ make_world_provider (const std::string& prov_name)
 
   throw std::runtime_error ("Unknown world provider name");
 }
+
+
+synchronized_world_provider::synchronized_world_provider (std::unique_ptr<world_provider> prov)
+  : prov (std::move (prov))
+{
+  // nop
+}
+
+void
+synchronized_world_provider::open (const std::string& path)
+{
+  std::lock_guard<std::mutex> guard (this->mtx);
+  this->prov->open (path);
+}
+
+void
+synchronized_world_provider::close ()
+{
+  std::lock_guard<std::mutex> guard (this->mtx);
+  this->prov->close ();
+}
+
+bool
+synchronized_world_provider::can_load_chunk (int cx, int cz)
+{
+  std::lock_guard<std::mutex> guard (this->mtx);
+  return this->prov->can_load_chunk (cx, cz);
+}
+
+chunk
+synchronized_world_provider::load_chunk (int cx, int cz)
+{
+  std::lock_guard<std::mutex> guard (this->mtx);
+  return this->prov->load_chunk (cx, cz);
+}
+
+void
+synchronized_world_provider::save_chunk (chunk& ch)
+{
+  std::lock_guard<std::mutex> guard (this->mtx);
+  this->prov->save_chunk (ch);
+}
@@ -19,6 +19,7 @@
 #include "world/providers/nw1/nw1.hpp"
 #include "world/providers/nw1/compress.hpp"
 #include <stdexcept>
+#include <algorithm>
 #include <cstring>
 
 #include "world/blocks.hpp"  // DEBUG
@@ -65,6 +66,17 @@ nw1_world_provider::can_load_chunk (int cx, int cz)
 
 
 
+/*!
+ * \brief Converts between the block order used by sections and the one
+ *        stored in nw1 files (in which X coordinates run backwards).
+ */
+static void
+_flip_x (unsigned short *ids)
+{
+  for (int i = 0; i < 4096; i += 16)
+    std::reverse (ids + i, ids + i + 16);
+}
+
 static void
 _deserialize_chunk (chunk& ch, const unsigned char *bytes)
 {
@@ -74,9 +86,12 @@ _deserialize_chunk (chunk& ch, const unsigned char *bytes)
     {
       if (section_bitmap & (1U << y))
         {
-          auto& section = ch.get_section (y);
-          ptr += nw1::decompress_array<unsigned short> (ptr, section.ids, 4096);
+          unsigned short ids[4096];
+          ptr += nw1::decompress_array<unsigned short> (ptr, ids, 4096);
+          _flip_x (ids);
+
           ch.add_section (y);
+          ch.get_section (y).set_ids (ids);
         }
     }
 }
@@ -101,7 +116,7 @@ nw1_world_provider::load_chunk (int cx, int cz)
 
 
 static std::string
-_serialize_chunk (chunk& ch)
+_serialize_chunk (const chunk& ch)
 {
   std::string data;
 
@@ -112,8 +127,11 @@ _serialize_chunk (chunk& ch)
     {
       if (ch.has_section (y))
         {
-          auto& section = ch.get_section (y);
-          nw1::compress_array<unsigned short> (section.ids, 4096, data);
+          unsigned short ids[4096];
+          ch.get_section (y).get_ids (ids);
+          _flip_x (ids);
+
+          nw1::compress_array<unsigned short> (ids, 4096, data);
         }
     }
 
@@ -0,0 +1,90 @@
+/*
+ * Nostalgia - A custom Minecraft server.
+ * Copyright (C) 2019  Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "world/section_pool.hpp"
+#include "world/chunk.hpp"
+#include "system/metrics.hpp"
+
+
+static metrics::gauge& _pooled_sections = metrics::get_gauge ("section_pool.sections");
+static metrics::counter& _pool_hits = metrics::get_counter ("section_pool.hits");
+
+//! \brief Returns the pool shared by all worlds.
+section_pool&
+section_pool::global ()
+{
+  static section_pool pool;
+  return pool;
+}
+
+std::shared_ptr<chunk_section>
+section_pool::intern (const std::shared_ptr<chunk_section>& section)
+{
+  if (section->is_pooled ())
+    return section;
+
+  auto hash = section->hash ();
+  std::lock_guard<std::mutex> guard (this->mtx);
+
+  auto range = this->sections.equal_range (hash);
+  for (auto itr = range.first; itr != range.second; )
+    {
+      auto existing = itr->second.lock ();
+      if (!existing)
+        {
+          itr = this->sections.erase (itr);
+          _pooled_sections.sub (1);
+          continue;
+        }
+
+      if (*existing == *section)
+        {
+          _pool_hits.add ();
+          return existing;
+        }
+      ++ itr;
+    }
+
+  section->mark_pooled ();
+  this->sections.emplace (hash, section);
+  _pooled_sections.add (1);
+
+  // sweep once the table could have doubled with dead entries
+  if (++ this->inserts_since_sweep >= this->sections.size () / 2)
+    this->sweep ();
+
+  return section;
+}
+
+//! \brief Drops entries of sections that no longer exist.
+void
+section_pool::sweep ()
+{
+  for (auto itr = this->sections.begin (); itr != this->sections.end (); )
+    {
+      if (itr->second.expired ())
+        {
+          itr = this->sections.erase (itr);
+          _pooled_sections.sub (1);
+        }
+      else
+        ++ itr;
+    }
+
+  this->inserts_since_sweep = 0;
+}
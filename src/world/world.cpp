@@ -16,29 +16,49 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 #include "world/world.hpp"
-#include "world/blocks.hpp"
-#include "system/atoms.hpp"
-#include "network/packets.hpp"
+#include "world/world_shard.hpp"
 #include "world/provider.hpp"
-
-#define MAX(A, B) (((A) > (B)) ? (A) : (B))
-#define ABS(A) (((A) < 0) ? (-(A)) : (A))
+#include "system/atoms.hpp"
+#include "util/position.hpp"
+#include <vector>
 
 
 world::world (caf::actor_config& cfg, unsigned int id, const std::string& name,
-    const caf::actor& srv, const caf::actor& script_eng, const caf::actor& world_gen)
-  : caf::blocking_actor (cfg), srv (srv), script_eng (script_eng), world_gen (world_gen)
+    const caf::actor& srv, const caf::actor& script_eng, const caf::actor& world_gen,
+    const caf::actor& chunk_encoder, size_t chunk_memory_budget)
+  : caf::event_based_actor (cfg), srv (srv), script_eng (script_eng), world_gen (world_gen),
+    chunk_encoder (chunk_encoder), chunk_memory_budget (chunk_memory_budget)
 {
   this->info.id = id;
   this->info.actor = this;
   this->info.name = name;
 
-  this->provider = make_world_provider ("nw1");
+  this->provider = std::make_shared<synchronized_world_provider> (make_world_provider ("nw1"));
 }
 
 
 void
-world::act ()
+world::on_exit ()
+{
+  this->provider->close ();
+}
+
+
+//! \brief Returns the chunks next to the specified one that belong to other regions.
+static std::vector<std::pair<int, int>>
+_border_neighbours (int cx, int cz)
+{
+  std::vector<std::pair<int, int>> res;
+  int rx = cx >> world_region_shift, rz = cz >> world_region_shift;
+  if (((cx - 1) >> world_region_shift) != rx) res.emplace_back (cx - 1, cz);
+  if (((cx + 1) >> world_region_shift) != rx) res.emplace_back (cx + 1, cz);
+  if (((cz - 1) >> world_region_shift) != rz) res.emplace_back (cx, cz - 1);
+  if (((cz + 1) >> world_region_shift) != rz) res.emplace_back (cx, cz + 1);
+  return res;
+}
+
+caf::behavior
+world::make_behavior ()
 {
   // open world file/directory
   this->provider->open ("worlds/" + this->info.name + ".nw1");
@@ -46,225 +66,151 @@ world::act ()
   // register with scripting engine
   this->send (this->script_eng, register_world_atom::value, this->info);
 
-  this->handle_messages ();
+  this->set_down_handler ([=] (caf::down_msg& msg) {
+    // a player went away
+    this->players.erase (msg.source);
+    for (auto& p : this->shards)
+      this->send (p.second, leave_world_atom::value, msg.source);
+  });
+
+  return {
+      [=] (join_world_atom, const caf::actor& cl, const caf::actor& broker) {
+        // get notified when the player goes away.
+        if (this->players.find (cl.address ()) == this->players.end ())
+          this->monitor (cl);
+        this->players[cl.address ()] = broker;
+      },
 
-  this->provider->close ();
-}
+      [=] (request_chunk_data_atom, int cx, int cz, const caf::actor& cl) {
+        auto itr = this->players.find (cl.address ());
+        if (itr == this->players.end ())
+          return; // not in this world
 
-//! \brief Handles actor messages.
-void
-world::handle_messages ()
-{
-  bool running = true;
-  this->receive_while (running) (
-      [=] (request_chunk_data_atom, int cx, int cz, const caf::actor& broker) {
-        // try to load chunk first
-        if (auto ch = this->load_chunk (cx, cz))
-          {
-            this->send (broker, packet_out_atom::value, ch->make_chunk_data_packet ().move_data ());
-          }
-        else
-          {
-            // generate the chunk if the chunk is not stored in memory and in provider.
-            this->request (this->world_gen, caf::infinite, generate_atom::value, chunk_pos (cx, cz), "flatgrass").receive (
-                [this, cx, cz, broker] (chunk ch) {
-                  auto key = std::make_pair (cx, cz);
-                  auto& new_ch = this->chunks[key] = std::make_unique<chunk> (std::move (ch));
-
-                  // send chunk to player.
-                  this->send (broker, packet_out_atom::value, new_ch->make_chunk_data_packet ().move_data ());
-                },
-                [this] (caf::error& err) {});
-          }
+        this->send (this->get_shard (cx, cz), request_chunk_data_atom::value, cx, cz, itr->first, itr->second);
       },
 
+      [=] (unload_chunk_atom, int cx, int cz, const caf::actor& cl) {
+        if (auto shard = this->find_shard (cx, cz))
+          this->send (shard, unload_chunk_atom::value, cx, cz, cl.address ());
+      },
+
+      // blocks can only be changed in chunks that are loaded, and so in
+      // regions that have a shard.
+
       [=] (set_block_atom, block_pos pos, unsigned short id) {
         chunk_pos cpos = pos;
-//        caf::aout (this) << "World: setblock at (" << pos.x << ", " << pos.y << ", " << pos.z << ") to " << id << std::endl;
-        auto ch = this->find_chunk (cpos.x, cpos.z);
-        if (ch)
-          {
-            ch->set_block_id (pos.x & 0xf, pos.y, pos.z & 0xf, id);
-            ch->mark_dirty ();
-
-            // update players
-            // TODO: Send this update only to players that are in range!!!
-            this->send (this->srv, broadcast_packet_atom::value, packets::play::make_block_change (pos, id).move_data ());
-
-            this->lighting_updates.push(lighting_update { pos });
-            this->handle_lighting ();
-          }
+        if (auto shard = this->find_shard (cpos.x, cpos.z))
+          this->send (shard, set_block_atom::value, pos, id);
       },
 
-      [=] (save_atom) {
-        this->save ();
+      [=] (lighting_update_atom, block_pos pos) {
+        chunk_pos cpos = pos;
+        if (auto shard = this->find_shard (cpos.x, cpos.z))
+          this->send (shard, lighting_update_atom::value, pos);
       },
 
-      [&] (stop_atom, const caf::actor& requester) {
-        running = false;
+      // snapshots of chunks on a region's border go to the shards on the
+      // other side of it, which read them while lighting.
 
-        // save world
-        this->save ();
+      [=] (border_chunk_atom, const chunk& ch) {
+        for (auto& n : _border_neighbours (ch.get_x (), ch.get_z ()))
+          if (auto shard = this->find_shard (n.first, n.second))
+            this->send (shard, border_chunk_atom::value, ch);
+      },
 
-        this->send (requester, stop_response_atom::value, this->get_typed_id ());
+      [=] (request_border_chunks_atom, int cx, int cz) {
+        for (auto& n : _border_neighbours (cx, cz))
+          if (auto shard = this->find_shard (n.first, n.second))
+            this->send (shard, share_border_chunk_atom::value, n.first, n.second);
       },
 
-      // scripting stuff:
+      [=] (drop_border_chunk_atom, int cx, int cz) {
+        for (auto& n : _border_neighbours (cx, cz))
+          if (auto shard = this->find_shard (n.first, n.second))
+            this->send (shard, drop_border_chunk_atom::value, cx, cz);
+      },
 
-      [=] (s_get_block_id_atom, int sid, int x, int y, int z) {
-        this->send (this->script_eng, s_get_block_id_atom::value, sid, this->get_block_id (x, y, z));
-      }
-  );
-}
+      // pins are kept by the shard even while the chunk is not loaded.
 
-//! \brief Processes queued sky/block lighting updates
-void
-world::handle_lighting (int max_updates)
-{
-  for (int i = 0; i < max_updates; ++i)
-    {
-      if (this->lighting_updates.empty ())
-        break;
-
-      auto update = this->lighting_updates.top ();
-      this->lighting_updates.pop ();
-
-      auto pos = update.pos;
-      auto id = this->get_block_id (pos.x, pos.y, pos.z);
-
-//      caf::aout (this) << "LIGHTING: Handling update (" << pos.x << ", " << pos.y << ", " << pos.z << "): " << id << std::endl;
-
-      if (is_opaque_block (id))
-        {
-          // TODO
-        }
-      else
-        {
-          // get neighbour skylight values
-          char sl_up = pos.y < 255 ? this->get_sky_light (pos.x, pos.y + 1, pos.z) : (char)15;
-          char sl_down = pos.y > 0 ? this->get_sky_light (pos.x, pos.y - 1, pos.z) : (char)15;
-          char sl_right = this->get_sky_light (pos.x + 1, pos.y, pos.z);
-          char sl_left = this->get_sky_light (pos.x - 1, pos.y, pos.z);
-          char sl_front = this->get_sky_light (pos.x, pos.y, pos.z + 1);
-          char sl_back = this->get_sky_light (pos.x, pos.y, pos.z - 1);
-
-//          caf::aout (this) << "LIGHTING: Neighbour values: " << (int)sl_up << ", " <<(int)sl_down << ", " <<(int)sl_right << ", " <<(int)sl_left << ", " <<(int)sl_front << ", " <<(int)sl_back << std::endl;
-
-          char this_sl = 0;
-          if (sl_up == 15)
-            // propagate vertical sunlight without change
-            this_sl = 15;
-          else
-            this_sl = MAX(sl_up, MAX(sl_down, MAX(sl_right, MAX(sl_left, MAX(sl_front, sl_back))))) - (char)1;
-
-          // keep value within bounds
-          if (this_sl < 0)
-            this_sl = 0;
-
-//          caf::aout (this) << "LIGHTING: Calculated value: " << (int)this_sl << std::endl;
-
-          this->set_sky_light (pos.x, pos.y, pos.z, (unsigned char)this_sl);
-
-          // enqueue all neighbours if their sky light value differs by more than one
-          if (pos.y < 255 && ABS(this_sl - sl_up) > 1 && !is_opaque_block (this->get_block_id (pos.x, pos.y + 1, pos.z)))
-            this->lighting_updates.push (lighting_update { block_pos (pos.x, pos.y + 1, pos.z) });
-          if (pos.y > 0 && !is_opaque_block (this->get_block_id (pos.x, pos.y - 1, pos.z)))
-            {
-              if (ABS(this_sl - sl_down) > 1 || (this_sl == 15 && sl_down != 15))
-                this->lighting_updates.push (lighting_update { block_pos (pos.x, pos.y - 1, pos.z) });
-            }
-          if (ABS(this_sl - sl_right) > 1 && !is_opaque_block (this->get_block_id (pos.x + 1, pos.y, pos.z)))
-            this->lighting_updates.push (lighting_update { block_pos (pos.x + 1, pos.y, pos.z) });
-          if (ABS(this_sl - sl_left) > 1 && !is_opaque_block (this->get_block_id (pos.x - 1, pos.y, pos.z)))
-            this->lighting_updates.push (lighting_update { block_pos (pos.x - 1, pos.y, pos.z) });
-          if (ABS(this_sl - sl_front) > 1 && !is_opaque_block (this->get_block_id (pos.x, pos.y, pos.z + 1)))
-            this->lighting_updates.push (lighting_update { block_pos (pos.x, pos.y, pos.z + 1) });
-          if (ABS(this_sl - sl_back) > 1 && !is_opaque_block (this->get_block_id (pos.x, pos.y, pos.z - 1)))
-            this->lighting_updates.push (lighting_update { block_pos (pos.x, pos.y, pos.z - 1) });
-        }
-    }
-}
+      [=] (pin_chunk_atom, int cx, int cz) {
+        this->send (this->get_shard (cx, cz), pin_chunk_atom::value, cx, cz);
+      },
 
+      [=] (unpin_chunk_atom, int cx, int cz) {
+        if (auto shard = this->find_shard (cx, cz))
+          this->send (shard, unpin_chunk_atom::value, cx, cz);
+      },
 
-void
-world::save ()
-{
-  caf::aout (this) << "Saving world: " << this->info.name << std::endl;
+      [=] (save_atom) {
+        caf::aout (this) << "Saving world: " << this->info.name << std::endl;
+        for (auto& p : this->shards)
+          this->send (p.second, save_atom::value);
+      },
 
-  for (auto& p : this->chunks)
-    {
-      auto& ch = *p.second;
-      if (ch.is_dirty ())
-        {
-          this->provider->save_chunk (ch);
-          ch.mark_dirty (false);
-        }
-    }
-}
+      [=] (stop_atom, const caf::actor& requester) {
+        this->stop (requester);
+      },
 
+      // scripting stuff:
 
+      [=] (s_get_block_id_atom, int sid, int x, int y, int z) {
+        chunk_pos cpos = block_pos (x, y, z);
+        if (auto shard = this->find_shard (cpos.x, cpos.z))
+          this->send (shard, s_get_block_id_atom::value, sid, x, y, z);
+        else
+          this->send (this->script_eng, s_get_block_id_atom::value, sid, (unsigned short)0);
+      }
+  };
+}
 
-chunk*
-world::find_chunk (int cx, int cz)
+//! \brief Returns the shard owning the specified chunk, spawning it if necessary.
+caf::actor
+world::get_shard (int cx, int cz)
 {
-  auto key = std::make_pair (cx, cz);
-  auto itr = this->chunks.find (key);
-  if (itr == this->chunks.end ())
-    return nullptr;
-  return itr->second.get ();
+  auto key = std::make_pair (cx >> world_region_shift, cz >> world_region_shift);
+  auto& shard = this->shards[key];
+  if (!shard)
+    shard = this->spawn<world_shard> (key.first, key.second, caf::actor (this), this->script_eng,
+                                      this->world_gen, this->chunk_encoder, this->provider,
+                                      this->chunk_memory_budget);
+  return shard;
 }
 
-chunk*
-world::load_chunk (int cx, int cz)
+//! \brief Returns the shard owning the specified chunk, or an invalid handle if it has not been spawned.
+caf::actor
+world::find_shard (int cx, int cz)
 {
-  if (auto ch_ptr = this->find_chunk (cx, cz))
-    return ch_ptr;
-
-  // chunk not stored in memory, consult provider.
-  try
-    {
-      auto ch = this->provider->load_chunk (cx, cz);
-      auto ch_ptr = new chunk (std::move (ch));
-      this->chunks[std::make_pair (cx, cz)] = std::unique_ptr<chunk> (ch_ptr);
-      return ch_ptr;
-    }
-  catch (const chunk_load_error&)
-    {
-      return nullptr;
-    }
+  auto itr = this->shards.find (std::make_pair (cx >> world_region_shift, cz >> world_region_shift));
+  return (itr == this->shards.end ()) ? caf::actor () : itr->second;
 }
 
-
+//! \brief Saves and stops all shards, then stops the world.
 void
-world::set_block_id (int x, int y, int z, unsigned short id)
+world::stop (const caf::actor& requester)
 {
-  chunk_pos cp = block_pos (x, y, z);
-  auto ch = this->find_chunk (cp.x, cp.z);
-  if (ch)
-    ch->set_block_id (x & 0xf, y, z & 0xf, id);
-}
+  caf::aout (this) << "Saving world: " << this->info.name << std::endl;
 
-unsigned short
-world::get_block_id (int x, int y, int z)
-{
-  chunk_pos cp = block_pos (x, y, z);
-  auto ch = this->find_chunk (cp.x, cp.z);
-  return ch ? ch->get_block_id (x & 0xf, y, z & 0xf) : (unsigned short)0;
-}
+  auto finish = [=] {
+    this->send (requester, stop_response_atom::value, this->get_typed_id ());
+    this->quit ();
+  };
 
-void
-world::set_sky_light (int x, int y, int z, unsigned char val)
-{
-  chunk_pos cp = block_pos (x, y, z);
-  auto ch = this->find_chunk (cp.x, cp.z);
-  if (ch)
-    ch->set_sky_light (x & 0xf, y, z & 0xf, val);
-}
+  if (this->shards.empty ())
+    {
+      finish ();
+      return;
+    }
 
-unsigned char
-world::get_sky_light (int x, int y, int z)
-{
-  chunk_pos cp = block_pos (x, y, z);
-  auto ch = this->find_chunk (cp.x, cp.z);
-  return ch ? ch->get_sky_light (x & 0xf, y, z & 0xf) : (unsigned char)15;
+  // shards answer once they have saved their chunks
+  auto pending = std::make_shared<size_t> (this->shards.size ());
+  for (auto& p : this->shards)
+    {
+      auto shard = p.second;
+      this->request (shard, caf::infinite, stop_atom::value).then (
+          [=] (bool) {
+            this->send_exit (shard, caf::exit_reason::user_shutdown);
+            if (-- *pending == 0)
+              finish ();
+          });
+    }
 }
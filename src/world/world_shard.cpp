@@ -0,0 +1,803 @@
+/*
+ * Nostalgia - A custom Minecraft server.
+ * Copyright (C) 2019  Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "world/world_shard.hpp"
+#include "world/blocks.hpp"
+#include "system/atoms.hpp"
+#include "network/packets.hpp"
+#include "network/packet_buffer.hpp"
+#include "world/provider.hpp"
+#include "system/metrics.hpp"
+#include <algorithm>
+
+#define MAX(A, B) (((A) > (B)) ? (A) : (B))
+#define ABS(A) (((A) < 0) ? (-(A)) : (A))
+
+
+static metrics::gauge& _resident_chunks = metrics::get_gauge ("world.resident_chunks");
+static metrics::gauge& _resident_chunk_bytes = metrics::get_gauge ("world.resident_chunk_bytes");
+static metrics::counter& _chunks_unloaded = metrics::get_counter ("world.chunks_unloaded");
+
+
+world_shard::world_shard (caf::actor_config& cfg, int rx, int rz, const caf::actor& world_actor,
+    const caf::actor& script_eng, const caf::actor& world_gen, const caf::actor& chunk_encoder,
+    std::shared_ptr<world_provider> provider, size_t chunk_memory_budget)
+  : caf::event_based_actor (cfg), rx (rx), rz (rz), world_actor (world_actor), script_eng (script_eng),
+    world_gen (world_gen), chunk_encoder (chunk_encoder), provider (std::move (provider)),
+    chunk_memory_budget (chunk_memory_budget)
+{
+  // nop
+}
+
+
+void
+world_shard::on_exit ()
+{
+  // chunks go away with the shard
+  for (auto& p : this->residency)
+    {
+      _resident_chunks.sub (1);
+      _resident_chunk_bytes.sub ((int64_t)p.second.bytes);
+    }
+  this->residency.clear ();
+  this->unused_chunks.clear ();
+}
+
+
+caf::behavior
+world_shard::make_behavior ()
+{
+  this->delayed_send (this, std::chrono::milliseconds (world_tick_interval_ms), world_tick_atom::value);
+
+  return {
+      [=] (request_chunk_data_atom, int cx, int cz, const caf::actor_addr& cl, const caf::actor& broker) {
+        this->subscribe_chunk (cx, cz, cl, broker);
+        this->request_chunk (cx, cz, broker);
+      },
+
+      [=] (set_block_atom, block_pos pos, unsigned short id) {
+        chunk_pos cpos = pos;
+//        caf::aout (this) << "World: setblock at (" << pos.x << ", " << pos.y << ", " << pos.z << ") to " << id << std::endl;
+        auto ch = this->find_chunk (cpos.x, cpos.z);
+        if (ch)
+          {
+            ch->set_block_id (pos.x & 0xf, pos.y, pos.z & 0xf, id);
+            ch->mark_dirty ();
+            if (is_border_chunk (cpos.x, cpos.z))
+              this->changed_border_chunks.insert (std::make_pair (cpos.x, cpos.z));
+            this->touch_chunk (cpos.x, cpos.z);
+
+            // players are updated at the end of the tick
+            auto bx = pos.x & 0xf, bz = pos.z & 0xf;
+            this->block_changes[std::make_pair (cpos.x, cpos.z)][(pos.y << 8) | (bx << 4) | bz] = id;
+
+            this->lighting_updates.push(lighting_update { pos });
+            this->handle_lighting ();
+          }
+      },
+
+      // handed off by a neighbouring shard (through the world)
+      [=] (lighting_update_atom, block_pos pos) {
+        chunk_pos cpos = pos;
+        if (!this->find_chunk (cpos.x, cpos.z))
+          return;
+
+        this->lighting_updates.push (lighting_update { pos });
+        this->handle_lighting ();
+      },
+
+      // snapshot of a chunk next to the region's border, shared by the
+      // neighbouring shard owning it (through the world)
+      [=] (border_chunk_atom, const chunk& ch) {
+        this->border_chunks.erase (ch.get_x (), ch.get_z ());
+        this->border_chunks.insert (ch.get_x (), ch.get_z (), std::make_unique<chunk> (ch));
+      },
+
+      // a neighbouring shard loaded a chunk next to this one
+      [=] (share_border_chunk_atom, int cx, int cz) {
+        if (auto ch = this->find_chunk (cx, cz))
+          this->send (this->world_actor, border_chunk_atom::value, chunk (*ch));
+      },
+
+      // a neighbouring shard unloaded a chunk next to this region
+      [=] (drop_border_chunk_atom, int cx, int cz) {
+        this->border_chunks.erase (cx, cz);
+      },
+
+      [=] (chunk_encoded_atom, int cx, int cz, uint64_t version, const caf::actor& broker) {
+        this->chunk_encoded (cx, cz, version, broker);
+      },
+
+      [=] (world_tick_atom) {
+        this->flush_block_changes ();
+        this->flush_light_changes ();
+        this->unload_unused_chunks ();
+        this->delayed_send (this, std::chrono::milliseconds (world_tick_interval_ms), world_tick_atom::value);
+      },
+
+      [=] (unload_chunk_atom, int cx, int cz, const caf::actor_addr& cl) {
+        this->unsubscribe_chunk (cx, cz, cl);
+      },
+
+      [=] (leave_world_atom, const caf::actor_addr& cl) {
+        this->unsubscribe_all (cl);
+      },
+
+      [=] (pin_chunk_atom, int cx, int cz) {
+        ++ this->pins[std::make_pair (cx, cz)];
+        this->load_chunk (cx, cz);
+        this->update_chunk_usage (cx, cz);
+      },
+
+      [=] (unpin_chunk_atom, int cx, int cz) {
+        auto itr = this->pins.find (std::make_pair (cx, cz));
+        if (itr == this->pins.end ())
+          return;
+        if (-- itr->second == 0)
+          {
+            this->pins.erase (itr);
+            this->update_chunk_usage (cx, cz);
+          }
+      },
+
+      [=] (save_atom) {
+        this->save ();
+      },
+
+      [=] (stop_atom) {
+        this->save ();
+        return true;
+      },
+
+      // scripting stuff:
+
+      [=] (s_get_block_id_atom, int sid, int x, int y, int z) {
+        this->send (this->script_eng, s_get_block_id_atom::value, sid, this->get_block_id (x, y, z));
+      }
+  };
+}
+
+static metrics::counter& _chunk_request_waits = metrics::get_counter ("world.chunk_request_waits");
+
+/*!
+ * \brief Sends a chunk to a player, loading or generating it first if necessary.
+ *
+ * A chunk is only generated once, no matter how many players ask for it
+ * while it is being generated: the first request starts the generation,
+ * later ones wait for it in pending_chunks.
+ */
+void
+world_shard::request_chunk (int cx, int cz, const caf::actor& broker)
+{
+  auto key = std::make_pair (cx, cz);
+  auto itr = this->pending_chunks.find (key);
+  if (itr != this->pending_chunks.end ())
+    {
+      auto& waiters = itr->second;
+      if (std::find (waiters.begin (), waiters.end (), broker) == waiters.end ())
+        waiters.push_back (broker);
+      _chunk_request_waits.add ();
+      return;
+    }
+
+  // try to load chunk first
+  if (auto ch = this->load_chunk (cx, cz))
+    {
+      this->encode_chunk (*ch, broker);
+      return;
+    }
+
+  this->pending_chunks[key].push_back (broker);
+  this->generate_chunk (cx, cz);
+}
+
+/*!
+ * \brief Has the world generator make the specified chunk, and sends it to
+ *        the players waiting for it (see pending_chunks) once it is done.
+ *
+ * Does not wait for the generator, so the shard keeps handling other
+ * messages (and other generations) in the meantime.
+ */
+void
+world_shard::generate_chunk (int cx, int cz)
+{
+  this->request (this->world_gen, caf::infinite, generate_atom::value, chunk_pos (cx, cz), "flatgrass").then (
+      [=] (chunk& ch) {
+        auto key = std::make_pair (cx, cz);
+        auto ch_ptr = this->add_chunk (cx, cz, std::make_unique<chunk> (std::move (ch)));
+
+        auto itr = this->pending_chunks.find (key);
+        if (itr == this->pending_chunks.end ())
+          return;
+        auto waiters = std::move (itr->second);
+        this->pending_chunks.erase (itr);
+
+        // send chunk to players (unless they moved away in the meantime).
+        for (auto& broker : waiters)
+          if (this->is_subscribed (cx, cz, broker))
+            this->encode_chunk (*ch_ptr, broker);
+      },
+      [=] (caf::error& err) {
+        caf::aout (this) << "Failed to generate chunk (" << cx << ", " << cz << "): "
+                         << this->system ().render (err) << std::endl;
+
+        // let the next request try again
+        this->pending_chunks.erase (std::make_pair (cx, cz));
+      });
+}
+
+//! \brief Queues a lighting update, handing it to the world if it belongs to another region.
+void
+world_shard::queue_lighting_update (block_pos pos)
+{
+  chunk_pos cpos = pos;
+  if (this->owns_chunk (cpos.x, cpos.z))
+    this->lighting_updates.push (lighting_update { pos });
+  else
+    this->lighting_handoffs.push_back (pos);
+}
+
+//! \brief Shares a newly loaded chunk with the neighbouring shards, and asks for the chunks next to it.
+void
+world_shard::exchange_border_chunks (const chunk& ch)
+{
+  if (!is_border_chunk (ch.get_x (), ch.get_z ()))
+    return;
+
+  // whichever of two neighbouring chunks is loaded last completes the
+  // exchange, the world drops messages for shards that do not exist yet.
+  this->send (this->world_actor, border_chunk_atom::value, chunk (ch));
+  this->send (this->world_actor, request_border_chunks_atom::value, ch.get_x (), ch.get_z ());
+}
+
+//! \brief Sends snapshots of border chunks that changed since they were last shared to the neighbouring shards.
+void
+world_shard::share_border_chunks ()
+{
+  for (auto& key : this->changed_border_chunks)
+    if (auto ch = this->find_chunk (key.first, key.second))
+      this->send (this->world_actor, border_chunk_atom::value, chunk (*ch));
+  this->changed_border_chunks.clear ();
+}
+
+//! \brief Processes queued sky/block lighting updates
+void
+world_shard::handle_lighting (int max_updates)
+{
+  for (int i = 0; i < max_updates; ++i)
+    {
+      if (this->lighting_updates.empty ())
+        break;
+
+      auto update = this->lighting_updates.top ();
+      this->lighting_updates.pop ();
+
+      auto pos = update.pos;
+      auto id = this->get_block_id (pos.x, pos.y, pos.z);
+
+//      caf::aout (this) << "LIGHTING: Handling update (" << pos.x << ", " << pos.y << ", " << pos.z << "): " << id << std::endl;
+
+      if (is_opaque_block (id))
+        {
+          // TODO
+        }
+      else
+        {
+          // get neighbour skylight values
+          char sl_up = pos.y < 255 ? this->get_sky_light (pos.x, pos.y + 1, pos.z) : (char)15;
+          char sl_down = pos.y > 0 ? this->get_sky_light (pos.x, pos.y - 1, pos.z) : (char)15;
+          char sl_right = this->get_sky_light (pos.x + 1, pos.y, pos.z);
+          char sl_left = this->get_sky_light (pos.x - 1, pos.y, pos.z);
+          char sl_front = this->get_sky_light (pos.x, pos.y, pos.z + 1);
+          char sl_back = this->get_sky_light (pos.x, pos.y, pos.z - 1);
+
+//          caf::aout (this) << "LIGHTING: Neighbour values: " << (int)sl_up << ", " <<(int)sl_down << ", " <<(int)sl_right << ", " <<(int)sl_left << ", " <<(int)sl_front << ", " <<(int)sl_back << std::endl;
+
+          char this_sl = 0;
+          if (sl_up == 15)
+            // propagate vertical sunlight without change
+            this_sl = 15;
+          else
+            this_sl = MAX(sl_up, MAX(sl_down, MAX(sl_right, MAX(sl_left, MAX(sl_front, sl_back))))) - (char)1;
+
+          // keep value within bounds
+          if (this_sl < 0)
+            this_sl = 0;
+
+//          caf::aout (this) << "LIGHTING: Calculated value: " << (int)this_sl << std::endl;
+
+          this->set_sky_light (pos.x, pos.y, pos.z, (unsigned char)this_sl);
+
+          // enqueue all neighbours if their sky light value differs by more than one
+          if (pos.y < 255 && ABS(this_sl - sl_up) > 1 && !is_opaque_block (this->get_block_id (pos.x, pos.y + 1, pos.z)))
+            this->queue_lighting_update (block_pos (pos.x, pos.y + 1, pos.z));
+          if (pos.y > 0 && !is_opaque_block (this->get_block_id (pos.x, pos.y - 1, pos.z)))
+            {
+              if (ABS(this_sl - sl_down) > 1 || (this_sl == 15 && sl_down != 15))
+                this->queue_lighting_update (block_pos (pos.x, pos.y - 1, pos.z));
+            }
+          if (ABS(this_sl - sl_right) > 1 && !is_opaque_block (this->get_block_id (pos.x + 1, pos.y, pos.z)))
+            this->queue_lighting_update (block_pos (pos.x + 1, pos.y, pos.z));
+          if (ABS(this_sl - sl_left) > 1 && !is_opaque_block (this->get_block_id (pos.x - 1, pos.y, pos.z)))
+            this->queue_lighting_update (block_pos (pos.x - 1, pos.y, pos.z));
+          if (ABS(this_sl - sl_front) > 1 && !is_opaque_block (this->get_block_id (pos.x, pos.y, pos.z + 1)))
+            this->queue_lighting_update (block_pos (pos.x, pos.y, pos.z + 1));
+          if (ABS(this_sl - sl_back) > 1 && !is_opaque_block (this->get_block_id (pos.x, pos.y, pos.z - 1)))
+            this->queue_lighting_update (block_pos (pos.x, pos.y, pos.z - 1));
+        }
+    }
+
+  // neighbours must see the light on this side before they handle the
+  // updates handed off to them.
+  this->share_border_chunks ();
+  for (auto& pos : this->lighting_handoffs)
+    this->send (this->world_actor, lighting_update_atom::value, pos);
+  this->lighting_handoffs.clear ();
+}
+
+
+void
+world_shard::save ()
+{
+  this->chunks.for_each ([this] (chunk& ch) {
+    if (ch.is_dirty ())
+      {
+        this->provider->save_chunk (ch);
+        ch.mark_dirty (false);
+      }
+  });
+}
+
+
+
+static metrics::counter& _block_change_packets = metrics::get_counter ("world.block_change_packets");
+static metrics::counter& _multi_block_change_packets = metrics::get_counter ("world.multi_block_change_packets");
+static metrics::counter& _section_resends = metrics::get_counter ("world.section_resends");
+static metrics::counter& _update_light_packets = metrics::get_counter ("world.update_light_packets");
+
+/*!
+ * \brief Has a snapshot of the chunk encoded and sent (along with its light) to a player.
+ *
+ * The snapshot shares its sections with the chunk, so it is cheap to make,
+ * and the world is free to keep modifying the chunk (copying sections on
+ * write) while it is being encoded.
+ */
+void
+world_shard::encode_chunk (const chunk& ch, const caf::actor& broker)
+{
+  auto key = std::make_pair (ch.get_x (), ch.get_z ());
+  this->chunks_in_flight[key][broker] = ch.get_version ();
+  this->send (this->chunk_encoder, encode_chunk_atom::value, chunk (ch), broker);
+}
+
+/*!
+ * \brief Called once a chunk has been sent to a player by the chunk encoder.
+ *
+ * Block changes made while the chunk was being encoded may have reached the
+ * player before the chunk did, so if the chunk changed in the meantime it is
+ * sent again.
+ */
+void
+world_shard::chunk_encoded (int cx, int cz, uint64_t version, const caf::actor& broker)
+{
+  auto key = std::make_pair (cx, cz);
+  auto itr = this->chunks_in_flight.find (key);
+  if (itr == this->chunks_in_flight.end ())
+    return;
+
+  auto b_itr = itr->second.find (broker);
+  if (b_itr == itr->second.end () || b_itr->second != version)
+    return; // a newer version is on its way
+  itr->second.erase (b_itr);
+  if (itr->second.empty ())
+    this->chunks_in_flight.erase (itr);
+
+  auto ch = this->find_chunk (cx, cz);
+  if (!ch || ch->get_version () == version)
+    return;
+
+  // resend if the player still has the chunk loaded
+  if (this->is_subscribed (cx, cz, broker))
+    this->encode_chunk (*ch, broker);
+}
+
+/*!
+ * \brief Sends block changes made during the last tick to players.
+ *
+ * All changes made to a chunk are sent together in a single MULTI BLOCK
+ * CHANGE packet (or a BLOCK CHANGE packet if only one block changed).
+ * Sections in which too many blocks were changed are resent in whole
+ * instead, using a partial CHUNK DATA packet.
+ */
+void
+world_shard::flush_block_changes ()
+{
+  for (auto& p : this->block_changes)
+    {
+      int cx = p.first.first, cz = p.first.second;
+      auto& changes = p.second;
+
+      auto ch = this->find_chunk (cx, cz);
+      if (!ch)
+        continue;
+
+      int counts[16] = { 0 };
+      for (auto& c : changes)
+        ++ counts[c.first >> 12];
+
+      if (this->chunk_subscribers.find (p.first) != this->chunk_subscribers.end ())
+        this->send_block_changes (*ch, changes, counts);
+
+      // free sections that were emptied out
+      for (unsigned y = 0; y < 16; ++y)
+        if (counts[y] > 0)
+          ch->release_if_empty (y);
+
+      this->update_chunk_memory (*ch);
+    }
+
+  this->block_changes.clear ();
+}
+
+/*!
+ * \brief Sends light of sections that changed during the last tick to players.
+ *
+ * Light changes are collected per section, so every chunk gets at most one
+ * UPDATE LIGHT packet per tick holding only the sections that changed.
+ */
+void
+world_shard::flush_light_changes ()
+{
+  for (auto& p : this->light_changes)
+    {
+      auto ch = this->find_chunk (p.first.first, p.first.second);
+      if (!ch)
+        continue;
+
+      this->update_chunk_memory (*ch);
+      if (this->chunk_subscribers.find (p.first) == this->chunk_subscribers.end ())
+        continue;
+
+      this->send_to_subscribers (p.first.first, p.first.second,
+                                 packet_buffer (ch->make_update_light_packet (p.second)));
+      _update_light_packets.add ();
+    }
+
+  this->light_changes.clear ();
+}
+
+//! \brief Sends block changes made to a chunk during the last tick to its subscribers.
+void
+world_shard::send_block_changes (chunk& ch, const std::map<unsigned short, unsigned short>& changes,
+                           const int counts[16])
+{
+  int cx = ch.get_x (), cz = ch.get_z ();
+
+  // find sections that are cheaper to resend
+  unsigned int resend_mask = 0;
+  for (int y = 0; y < 16; ++y)
+    if (counts[y] >= section_resend_threshold)
+      {
+        resend_mask |= 1U << y;
+        _section_resends.add ();
+      }
+
+  if (resend_mask)
+    this->send_to_subscribers (cx, cz, packet_buffer (ch.make_chunk_data_packet (resend_mask)));
+
+  std::vector<block_change_record> records;
+  for (auto& c : changes)
+    if (!(resend_mask & (1U << (c.first >> 12))))
+      records.push_back ({ (unsigned char)(c.first & 0xff), (unsigned char)(c.first >> 8), c.second });
+
+  if (records.size () == 1)
+    {
+      auto& rec = records.front ();
+      block_pos pos (cx * 16 + (rec.xz >> 4), rec.y, cz * 16 + (rec.xz & 0xf));
+      this->send_to_subscribers (cx, cz, packet_buffer (packets::play::make_block_change (pos, rec.id)));
+      _block_change_packets.add ();
+    }
+  else if (records.size () > 1)
+    {
+      this->send_to_subscribers (cx, cz, packet_buffer (packets::play::make_multi_block_change (cx, cz, records)));
+      _multi_block_change_packets.add ();
+    }
+}
+
+
+chunk*
+world_shard::find_chunk (int cx, int cz)
+{
+  return this->chunks.find (cx, cz);
+}
+
+//! \brief Like find_chunk, but also finds snapshots of chunks just across the region's border (which must not be modified).
+chunk*
+world_shard::find_readable_chunk (int cx, int cz)
+{
+  if (this->owns_chunk (cx, cz))
+    return this->find_chunk (cx, cz);
+
+  return this->border_chunks.find (cx, cz);
+}
+
+void
+world_shard::subscribe_chunk (int cx, int cz, const caf::actor_addr& cl, const caf::actor& broker)
+{
+  auto key = std::make_pair (cx, cz);
+  this->subscriptions[cl].insert (key);
+  this->chunk_subscribers[key][cl] = broker;
+  this->update_chunk_usage (cx, cz);
+}
+
+void
+world_shard::unsubscribe_chunk (int cx, int cz, const caf::actor_addr& cl)
+{
+  auto key = std::make_pair (cx, cz);
+  auto itr = this->chunk_subscribers.find (key);
+  if (itr != this->chunk_subscribers.end ())
+    {
+      itr->second.erase (cl);
+      if (itr->second.empty ())
+        {
+          this->chunk_subscribers.erase (itr);
+          this->update_chunk_usage (cx, cz);
+        }
+    }
+
+  auto sub_itr = this->subscriptions.find (cl);
+  if (sub_itr != this->subscriptions.end ())
+    sub_itr->second.erase (key);
+}
+
+void
+world_shard::unsubscribe_all (const caf::actor_addr& cl)
+{
+  auto itr = this->subscriptions.find (cl);
+  if (itr == this->subscriptions.end ())
+    return;
+
+  for (auto& key : itr->second)
+    {
+      auto sub_itr = this->chunk_subscribers.find (key);
+      if (sub_itr != this->chunk_subscribers.end ())
+        {
+          sub_itr->second.erase (cl);
+          if (sub_itr->second.empty ())
+            {
+              this->chunk_subscribers.erase (sub_itr);
+              this->update_chunk_usage (key.first, key.second);
+            }
+        }
+    }
+
+  this->subscriptions.erase (itr);
+}
+
+//! \brief Checks whether the player using the specified broker has the specified chunk loaded.
+bool
+world_shard::is_subscribed (int cx, int cz, const caf::actor& broker)
+{
+  auto itr = this->chunk_subscribers.find (std::make_pair (cx, cz));
+  if (itr == this->chunk_subscribers.end ())
+    return false;
+
+  for (auto& p : itr->second)
+    if (p.second == broker)
+      return true;
+  return false;
+}
+
+void
+world_shard::send_to_subscribers (int cx, int cz, const packet_buffer& buf)
+{
+  auto itr = this->chunk_subscribers.find (std::make_pair (cx, cz));
+  if (itr == this->chunk_subscribers.end ())
+    return;
+
+  for (auto& p : itr->second)
+    this->send (p.second, packet_out_atom::value, buf);
+}
+
+
+chunk*
+world_shard::load_chunk (int cx, int cz)
+{
+  if (auto ch_ptr = this->find_chunk (cx, cz))
+    return ch_ptr;
+
+  // chunk not stored in memory, consult provider.
+  try
+    {
+      auto ch = this->provider->load_chunk (cx, cz);
+      ch.pool_sections ();
+      return this->add_chunk (cx, cz, std::make_unique<chunk> (std::move (ch)));
+    }
+  catch (const chunk_load_error&)
+    {
+      return nullptr;
+    }
+}
+
+
+//! \brief Stores a chunk that was loaded or generated, unless there already is one at its coordinates.
+chunk*
+world_shard::add_chunk (int cx, int cz, std::unique_ptr<chunk> ch)
+{
+  auto ch_ptr = ch.get ();
+  auto stored = this->chunks.insert (cx, cz, std::move (ch));
+  if (stored != ch_ptr)
+    return stored; // already loaded
+
+  auto key = std::make_pair (cx, cz);
+  auto& res = this->residency[key];
+  res.bytes = stored->memory_usage ();
+  res.unused = false;
+  _resident_chunks.add (1);
+  _resident_chunk_bytes.add ((int64_t)res.bytes);
+
+  this->update_chunk_usage (cx, cz);
+  this->exchange_border_chunks (*stored);
+  return stored;
+}
+
+//! \brief Checks whether players, scripts or the spawn area keep the specified chunk loaded.
+bool
+world_shard::is_chunk_in_use (int cx, int cz)
+{
+  // players spawn in chunk (0, 0)
+  if (ABS(cx) <= spawn_chunk_radius && ABS(cz) <= spawn_chunk_radius)
+    return true;
+
+  auto key = std::make_pair (cx, cz);
+  return this->chunk_subscribers.find (key) != this->chunk_subscribers.end ()
+         || this->pins.find (key) != this->pins.end ();
+}
+
+//! \brief Moves a loaded chunk into or out of the unused list after its users changed.
+void
+world_shard::update_chunk_usage (int cx, int cz)
+{
+  auto key = std::make_pair (cx, cz);
+  auto itr = this->residency.find (key);
+  if (itr == this->residency.end ())
+    return; // not loaded
+
+  auto& res = itr->second;
+  bool unused = !this->is_chunk_in_use (cx, cz);
+  if (unused == res.unused)
+    return;
+
+  if (unused)
+    res.lru_pos = this->unused_chunks.insert (this->unused_chunks.end (), key);
+  else
+    this->unused_chunks.erase (res.lru_pos);
+  res.unused = unused;
+}
+
+//! \brief Marks an unused chunk as the most recently used one.
+void
+world_shard::touch_chunk (int cx, int cz)
+{
+  auto itr = this->residency.find (std::make_pair (cx, cz));
+  if (itr != this->residency.end () && itr->second.unused)
+    this->unused_chunks.splice (this->unused_chunks.end (), this->unused_chunks, itr->second.lru_pos);
+}
+
+//! \brief Updates the memory usage recorded for a loaded chunk.
+void
+world_shard::update_chunk_memory (const chunk& ch)
+{
+  auto itr = this->residency.find (std::make_pair (ch.get_x (), ch.get_z ()));
+  if (itr == this->residency.end ())
+    return;
+
+  auto bytes = ch.memory_usage ();
+  _resident_chunk_bytes.add ((int64_t)bytes - (int64_t)itr->second.bytes);
+  itr->second.bytes = bytes;
+}
+
+/*!
+ * \brief Unloads unused chunks until chunks fit in the memory budget again.
+ *
+ * The budget covers the chunks of all shards (of all worlds), but every
+ * shard can only unload its own chunks, so a shard with no unused chunks
+ * leaves it to the others.
+ */
+void
+world_shard::unload_unused_chunks ()
+{
+  while (!this->unused_chunks.empty ()
+         && (uint64_t)_resident_chunk_bytes.get () > this->chunk_memory_budget)
+    {
+      auto key = this->unused_chunks.front ();
+      this->evict_chunk (key.first, key.second);
+    }
+}
+
+//! \brief Saves the specified chunk if necessary and removes it from memory.
+void
+world_shard::evict_chunk (int cx, int cz)
+{
+  auto key = std::make_pair (cx, cz);
+  auto itr = this->residency.find (key);
+  if (itr == this->residency.end ())
+    return;
+
+  if (auto ch = this->find_chunk (cx, cz))
+    if (ch->is_dirty ())
+      this->provider->save_chunk (*ch);
+
+  if (itr->second.unused)
+    this->unused_chunks.erase (itr->second.lru_pos);
+  _resident_chunks.sub (1);
+  _resident_chunk_bytes.sub ((int64_t)itr->second.bytes);
+  this->residency.erase (itr);
+
+  this->chunks.erase (cx, cz);
+  this->block_changes.erase (key);
+  this->light_changes.erase (key);
+  if (is_border_chunk (cx, cz))
+    {
+      this->changed_border_chunks.erase (key);
+      this->send (this->world_actor, drop_border_chunk_atom::value, cx, cz);
+    }
+  _chunks_unloaded.add ();
+}
+
+
+void
+world_shard::set_block_id (int x, int y, int z, unsigned short id)
+{
+  chunk_pos cp = block_pos (x, y, z);
+  auto ch = this->find_chunk (cp.x, cp.z);
+  if (ch)
+    ch->set_block_id (x & 0xf, y, z & 0xf, id);
+}
+
+unsigned short
+world_shard::get_block_id (int x, int y, int z)
+{
+  chunk_pos cp = block_pos (x, y, z);
+  auto ch = this->find_readable_chunk (cp.x, cp.z);
+  return ch ? ch->get_block_id (x & 0xf, y, z & 0xf) : (unsigned short)0;
+}
+
+void
+world_shard::set_sky_light (int x, int y, int z, unsigned char val)
+{
+  chunk_pos cp = block_pos (x, y, z);
+  auto ch = this->find_chunk (cp.x, cp.z);
+  if (!ch || y < 0 || y >= 256)
+    return;
+
+  if (ch->get_sky_light (x & 0xf, y, z & 0xf) != val)
+    {
+      ch->set_sky_light (x & 0xf, y, z & 0xf, val);
+      this->light_changes[std::make_pair (cp.x, cp.z)] |= 1U << (y >> 4);
+      if (is_border_chunk (cp.x, cp.z))
+        this->changed_border_chunks.insert (std::make_pair (cp.x, cp.z));
+    }
+}
+
+unsigned char
+world_shard::get_sky_light (int x, int y, int z)
+{
+  chunk_pos cp = block_pos (x, y, z);
+  auto ch = this->find_readable_chunk (cp.x, cp.z);
+  return ch ? ch->get_sky_light (x & 0xf, y, z & 0xf) : (unsigned char)15;
+}